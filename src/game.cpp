@@ -0,0 +1,1816 @@
+#include "game.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+/* Assets
+ *
+ * Sprite art is written one byte per pixel below and baked into packed,
+ * pre-shifted row masks at compile time. The resulting tables live in
+ * read-only static storage, so no sprite data is allocated or decoded at
+ * startup and all games in a process share them.
+ */
+
+template<size_t NumRows>
+struct SpriteRows
+{
+        uint64_t rows[NumRows * SPRITE_NUM_SHIFTS];
+};
+
+template<size_t Width, size_t NumRows>
+constexpr SpriteRows<NumRows> sprite_bake(const uint8_t (&pixels)[Width * NumRows])
+{
+        static_assert(Width <= SPRITE_MAX_WIDTH, "sprite too wide for packed rows");
+
+        SpriteRows<NumRows> result = {};
+        for(size_t yi = 0; yi < NumRows; ++yi)
+        {
+                uint64_t mask = 0;
+                for(size_t xi = 0; xi < Width; ++xi)
+                {
+                        mask |= (uint64_t)(pixels[yi * Width + xi] != 0) << xi;
+                }
+
+                for(size_t shift = 0; shift < SPRITE_NUM_SHIFTS; ++shift)
+                {
+                        result.rows[yi * SPRITE_NUM_SHIFTS + shift] = mask << shift;
+                }
+        }
+
+        return result;
+}
+
+static constexpr uint8_t alien_sprite_0_pixels[64] =
+{
+        0,0,0,1,1,0,0,0, // ...@@...
+        0,0,1,1,1,1,0,0, // ..@@@@..
+        0,1,1,1,1,1,1,0, // .@@@@@@.
+        1,1,0,1,1,0,1,1, // @@.@@.@@
+        1,1,1,1,1,1,1,1, // @@@@@@@@
+        0,1,0,1,1,0,1,0, // .@.@@.@.
+        1,0,0,0,0,0,0,1, // @......@
+        0,1,0,0,0,0,1,0  // .@....@.
+};
+static constexpr SpriteRows<8> alien_sprite_0_rows = sprite_bake<8, 8>(alien_sprite_0_pixels);
+
+static constexpr uint8_t alien_sprite_1_pixels[64] =
+{
+        0,0,0,1,1,0,0,0, // ...@@...
+        0,0,1,1,1,1,0,0, // ..@@@@..
+        0,1,1,1,1,1,1,0, // .@@@@@@.
+        1,1,0,1,1,0,1,1, // @@.@@.@@
+        1,1,1,1,1,1,1,1, // @@@@@@@@
+        0,0,1,0,0,1,0,0, // ..@..@..
+        0,1,0,1,1,0,1,0, // .@.@@.@.
+        1,0,1,0,0,1,0,1  // @.@..@.@
+};
+static constexpr SpriteRows<8> alien_sprite_1_rows = sprite_bake<8, 8>(alien_sprite_1_pixels);
+
+static constexpr uint8_t alien_sprite_2_pixels[88] =
+{
+        0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
+        0,0,0,1,0,0,0,1,0,0,0, // ...@...@...
+        0,0,1,1,1,1,1,1,1,0,0, // ..@@@@@@@..
+        0,1,1,0,1,1,1,0,1,1,0, // .@@.@@@.@@.
+        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
+        1,0,1,1,1,1,1,1,1,0,1, // @.@@@@@@@.@
+        1,0,1,0,0,0,0,0,1,0,1, // @.@.....@.@
+        0,0,0,1,1,0,1,1,0,0,0  // ...@@.@@...
+};
+static constexpr SpriteRows<8> alien_sprite_2_rows = sprite_bake<11, 8>(alien_sprite_2_pixels);
+
+static constexpr uint8_t alien_sprite_3_pixels[88] =
+{
+        0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
+        1,0,0,1,0,0,0,1,0,0,1, // @..@...@..@
+        1,0,1,1,1,1,1,1,1,0,1, // @.@@@@@@@.@
+        1,1,1,0,1,1,1,0,1,1,1, // @@@.@@@.@@@
+        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
+        0,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@.
+        0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
+        0,1,0,0,0,0,0,0,0,1,0  // .@.......@.
+};
+static constexpr SpriteRows<8> alien_sprite_3_rows = sprite_bake<11, 8>(alien_sprite_3_pixels);
+
+static constexpr uint8_t alien_sprite_4_pixels[96] =
+{
+        0,0,0,0,1,1,1,1,0,0,0,0, // ....@@@@....
+        0,1,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@@.
+        1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
+        1,1,1,0,0,1,1,0,0,1,1,1, // @@@..@@..@@@
+        1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
+        0,0,0,1,1,0,0,1,1,0,0,0, // ...@@..@@...
+        0,0,1,1,0,1,1,0,1,1,0,0, // ..@@.@@.@@..
+        1,1,0,0,0,0,0,0,0,0,1,1  // @@........@@
+};
+static constexpr SpriteRows<8> alien_sprite_4_rows = sprite_bake<12, 8>(alien_sprite_4_pixels);
+
+static constexpr uint8_t alien_sprite_5_pixels[96] =
+{
+        0,0,0,0,1,1,1,1,0,0,0,0, // ....@@@@....
+        0,1,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@@.
+        1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
+        1,1,1,0,0,1,1,0,0,1,1,1, // @@@..@@..@@@
+        1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
+        0,0,1,1,1,0,0,1,1,1,0,0, // ..@@@..@@@..
+        0,1,1,0,0,1,1,0,0,1,1,0, // .@@..@@..@@.
+        0,0,1,1,0,0,0,0,1,1,0,0  // ..@@....@@..
+};
+static constexpr SpriteRows<8> alien_sprite_5_rows = sprite_bake<12, 8>(alien_sprite_5_pixels);
+
+static constexpr uint8_t alien_death_sprite_pixels[91] =
+{
+        0,1,0,0,1,0,0,0,1,0,0,1,0, // .@..@...@..@.
+        0,0,1,0,0,1,0,1,0,0,1,0,0, // ..@..@.@..@..
+        0,0,0,1,0,0,0,0,0,1,0,0,0, // ...@.....@...
+        1,1,0,0,0,0,0,0,0,0,0,1,1, // @@.........@@
+        0,0,0,1,0,0,0,0,0,1,0,0,0, // ...@.....@...
+        0,0,1,0,0,1,0,1,0,0,1,0,0, // ..@..@.@..@..
+        0,1,0,0,1,0,0,0,1,0,0,1,0  // .@..@...@..@.
+};
+static constexpr SpriteRows<7> alien_death_sprite_rows = sprite_bake<13, 7>(alien_death_sprite_pixels);
+
+static constexpr uint8_t player_sprite_pixels[77] =
+{
+        0,0,0,0,0,1,0,0,0,0,0, // .....@.....
+        0,0,0,0,1,1,1,0,0,0,0, // ....@@@....
+        0,0,0,0,1,1,1,0,0,0,0, // ....@@@....
+        0,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@.
+        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
+        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
+        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
+};
+static constexpr SpriteRows<7> player_sprite_rows = sprite_bake<11, 7>(player_sprite_pixels);
+
+static constexpr uint8_t text_spritesheet_pixels[65 * 35] = // 65 chars with size 5x7
+{
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+        0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,0,0,1,0,0,
+        0,1,0,1,0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+        0,1,0,1,0,0,1,0,1,0,1,1,1,1,1,0,1,0,1,0,1,1,1,1,1,0,1,0,1,0,0,1,0,1,0,
+        0,0,1,0,0,0,1,1,1,0,1,0,1,0,0,0,1,1,1,0,0,0,1,0,1,0,1,1,1,0,0,0,1,0,0,
+        1,1,0,1,0,1,1,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,1,1,0,1,0,1,1,
+        0,1,1,0,0,1,0,0,1,0,1,0,0,1,0,0,1,1,0,0,1,0,0,1,0,1,0,0,0,1,0,1,1,1,1,
+        0,0,0,1,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+        0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,
+        1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,
+        0,0,1,0,0,1,0,1,0,1,0,1,1,1,0,0,0,1,0,0,0,1,1,1,0,1,0,1,0,1,0,0,1,0,0,
+        0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,1,1,1,1,1,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,
+        0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,
+
+        0,1,1,1,0,1,0,0,0,1,1,0,0,1,1,1,0,1,0,1,1,1,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        0,0,1,0,0,0,1,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,1,1,0,
+        0,1,1,1,0,1,0,0,0,1,0,0,0,0,1,0,0,1,1,0,0,1,0,0,0,1,0,0,0,0,1,1,1,1,1,
+        1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,1,0,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        0,0,0,1,0,0,0,1,1,0,0,1,0,1,0,1,0,0,1,0,1,1,1,1,1,0,0,0,1,0,0,0,0,1,0,
+        1,1,1,1,1,1,0,0,0,0,1,1,1,1,0,0,0,0,0,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+
+        0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,
+        0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,
+        0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,
+        0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,
+        1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,
+        0,1,1,1,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,0,0,1,0,0,
+        0,1,1,1,0,1,0,0,0,1,1,0,1,0,1,1,1,0,1,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,0,
+
+        0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,1,1,0,0,0,1,1,0,0,0,1,
+        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,1,1,1,0,
+        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,
+        1,1,1,1,1,1,0,0,0,0,1,0,0,0,0,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,1,1,1,1,
+        1,1,1,1,1,1,0,0,0,0,1,0,0,0,0,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,0,1,1,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,1,1,1,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,
+        0,1,1,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,1,1,0,
+        0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        1,0,0,0,1,1,0,0,1,0,1,0,1,0,0,1,1,0,0,0,1,0,1,0,0,1,0,0,1,0,1,0,0,0,1,
+        1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,1,1,1,1,
+        1,0,0,0,1,1,1,0,1,1,1,0,1,0,1,1,0,1,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,
+        1,0,0,0,1,1,0,0,0,1,1,1,0,0,1,1,0,1,0,1,1,0,0,1,1,1,0,0,0,1,1,0,0,0,1,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,1,0,1,1,0,0,1,1,0,1,1,1,1,
+        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,1,0,0,1,0,0,1,0,1,0,0,0,1,
+        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,0,1,1,1,0,1,0,0,0,1,0,0,0,0,1,0,1,1,1,0,
+        1,1,1,1,1,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,
+        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
+        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,
+        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,1,0,1,1,0,1,0,1,1,1,0,1,1,1,0,0,0,1,
+        1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,1,0,0,0,1,
+        1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,
+        1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,1,1,1,1,
+
+        0,0,0,1,1,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,1,
+        0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,
+        1,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,1,1,0,0,0,
+        0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,
+        0,0,1,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
+};
+static constexpr SpriteRows<65 * 7> text_spritesheet_rows = sprite_bake<5, 65 * 7>(text_spritesheet_pixels);
+
+static constexpr uint8_t bullet_sprite_pixels[3] =
+{
+        1, // @
+        1, // @
+        1  // @
+};
+static constexpr SpriteRows<3> bullet_sprite_rows = sprite_bake<1, 3>(bullet_sprite_pixels);
+
+static constexpr Sprite alien_sprites[6] =
+{
+        {8,  8, alien_sprite_0_rows.rows},
+        {8,  8, alien_sprite_1_rows.rows},
+        {11, 8, alien_sprite_2_rows.rows},
+        {11, 8, alien_sprite_3_rows.rows},
+        {12, 8, alien_sprite_4_rows.rows},
+        {12, 8, alien_sprite_5_rows.rows}
+};
+
+static constexpr Sprite alien_death_sprite = {13, 7, alien_death_sprite_rows.rows};
+static constexpr Sprite player_sprite = {11, 7, player_sprite_rows.rows};
+static constexpr Sprite bullet_sprite = {1, 3, bullet_sprite_rows.rows};
+
+// 65 glyphs starting at ' ', the digits start at glyph 16
+static constexpr Sprite text_spritesheet = {5, 7, text_spritesheet_rows.rows};
+static constexpr Sprite number_spritesheet = {5, 7, text_spritesheet_rows.rows + 16 * 7 * SPRITE_NUM_SHIFTS};
+
+static constexpr const Sprite* alien_animation_frames[3][2] =
+{
+        {&alien_sprites[0], &alien_sprites[1]},
+        {&alien_sprites[2], &alien_sprites[3]},
+        {&alien_sprites[4], &alien_sprites[5]}
+};
+
+// Two frames per alien type, 50 ticks each
+static constexpr SpriteAnimation alien_animations[3] =
+{
+        {true, 2, 50, alien_animation_frames[0]},
+        {true, 2, 50, alien_animation_frames[1]},
+        {true, 2, 50, alien_animation_frames[2]}
+};
+
+constexpr SpriteTable sprite_tables[NUM_SPRITE_TABLES] =
+{
+        {alien_sprite_0_rows.rows, 8},
+        {alien_sprite_1_rows.rows, 8},
+        {alien_sprite_2_rows.rows, 8},
+        {alien_sprite_3_rows.rows, 8},
+        {alien_sprite_4_rows.rows, 8},
+        {alien_sprite_5_rows.rows, 8},
+        {alien_death_sprite_rows.rows, 7},
+        {player_sprite_rows.rows, 7},
+        {text_spritesheet_rows.rows, 65 * 7},
+        {bullet_sprite_rows.rows, 3}
+};
+
+// Adds a chunk, and the slots for its bullets. Only runs when the pool
+// is full.
+void bullet_pool_grow(BulletPool* pool)
+{
+        size_t old_slots = pool->num_chunks * BULLET_CHUNK_SIZE;
+        size_t num_slots = old_slots + BULLET_CHUNK_SIZE;
+
+        BulletChunk** chunks = new BulletChunk*[pool->num_chunks + 1];
+        uint32_t* slot_index = new uint32_t[num_slots];
+        uint32_t* slot_generation = new uint32_t[num_slots];
+        for(size_t c = 0; c < pool->num_chunks; ++c) chunks[c] = pool->chunks[c];
+        for(size_t i = 0; i < old_slots; ++i)
+        {
+                slot_index[i] = pool->slot_index[i];
+                slot_generation[i] = pool->slot_generation[i];
+        }
+        chunks[pool->num_chunks] = new BulletChunk;
+
+        // The new slots go on the free list in order
+        for(size_t i = old_slots; i < num_slots; ++i)
+        {
+                slot_index[i] = i + 1 < num_slots? (uint32_t)(i + 1): pool->free_slot;
+                slot_generation[i] = 0;
+        }
+        pool->free_slot = (uint32_t)old_slots;
+
+        delete[] pool->chunks;
+        delete[] pool->slot_index;
+        delete[] pool->slot_generation;
+        pool->chunks = chunks;
+        pool->slot_index = slot_index;
+        pool->slot_generation = slot_generation;
+        ++pool->num_chunks;
+}
+
+// Allocates chunks for at least capacity bullets up front
+void bullet_pool_init(BulletPool* pool, size_t capacity)
+{
+        pool->num_bullets = 0;
+        pool->num_chunks = 0;
+        pool->chunks = 0;
+        pool->slot_index = 0;
+        pool->slot_generation = 0;
+        pool->free_slot = BULLET_NO_SLOT;
+        pool->num_moved = 0;
+        pool->frame_peak = 0;
+        pool->peak = 0;
+        pool->frame_peak_total = 0;
+        pool->num_ticks = 0;
+
+        do bullet_pool_grow(pool);
+        while(pool->num_chunks * BULLET_CHUNK_SIZE < capacity);
+}
+
+void bullet_pool_destroy(BulletPool* pool)
+{
+        for(size_t c = 0; c < pool->num_chunks; ++c) delete pool->chunks[c];
+        delete[] pool->chunks;
+        delete[] pool->slot_index;
+        delete[] pool->slot_generation;
+        pool->chunks = 0;
+        pool->slot_index = pool->slot_generation = 0;
+        pool->num_bullets = pool->num_chunks = 0;
+}
+
+// Number of bullets in chunk c
+size_t bullet_pool_chunk_size(const BulletPool* pool, size_t c)
+{
+        size_t begin = c * BULLET_CHUNK_SIZE;
+        if(begin >= pool->num_bullets) return 0;
+        return pool->num_bullets - begin < BULLET_CHUNK_SIZE? pool->num_bullets - begin: BULLET_CHUNK_SIZE;
+}
+
+BulletHandle bullet_pool_spawn(BulletPool* pool, int x, int y, int dir)
+{
+        if(pool->free_slot == BULLET_NO_SLOT) bullet_pool_grow(pool);
+
+        uint32_t slot = pool->free_slot;
+        pool->free_slot = pool->slot_index[slot];
+
+        size_t i = pool->num_bullets++;
+        BulletChunk* chunk = pool->chunks[i / BULLET_CHUNK_SIZE];
+        size_t offset = i % BULLET_CHUNK_SIZE;
+        chunk->x[offset] = (int16_t)x;
+        chunk->y[offset] = (int16_t)y;
+        chunk->dir[offset] = (int16_t)dir;
+        chunk->slot[offset] = slot;
+        pool->slot_index[slot] = (uint32_t)i;
+
+        if(pool->num_bullets > pool->frame_peak) pool->frame_peak = pool->num_bullets;
+        if(pool->num_bullets > pool->peak) pool->peak = pool->num_bullets;
+
+        BulletHandle handle = {slot, pool->slot_generation[slot]};
+        return handle;
+}
+
+// Returns whether the bullet of handle is still alive, and its index
+bool bullet_pool_lookup(const BulletPool* pool, BulletHandle handle, size_t* index)
+{
+        if(handle.slot >= pool->num_chunks * BULLET_CHUNK_SIZE ||
+           pool->slot_generation[handle.slot] != handle.generation)
+        {
+                return false;
+        }
+        *index = pool->slot_index[handle.slot];
+        return true;
+}
+
+// Removes every bullet and frees its slot, handles to them turn stale
+void bullet_pool_clear(BulletPool* pool)
+{
+        for(size_t i = 0; i < pool->num_bullets; ++i)
+        {
+                uint32_t slot = pool->chunks[i / BULLET_CHUNK_SIZE]->slot[i % BULLET_CHUNK_SIZE];
+                ++pool->slot_generation[slot];
+                pool->slot_index[slot] = pool->free_slot;
+                pool->free_slot = slot;
+        }
+        pool->num_bullets = 0;
+        pool->num_moved = 0;
+}
+
+// Starts the high-water mark of a new tick at the bullets carried over
+void bullet_pool_begin_tick(BulletPool* pool)
+{
+        pool->frame_peak = pool->num_bullets;
+}
+
+// Adds the high-water mark of the finished tick to the totals
+void bullet_pool_end_tick(BulletPool* pool)
+{
+        pool->frame_peak_total += pool->frame_peak;
+        ++pool->num_ticks;
+}
+
+// Moves every bullet by its direction. The keep flag of a bullet is set
+// if it is still inside rows [min_y, max_y) and cleared otherwise.
+void bullet_chunk_integrate(BulletChunk* chunk, size_t num_bullets, int min_y, int max_y)
+{
+        int16_t* y = chunk->y;
+        const int16_t* dir = chunk->dir;
+        uint8_t* keep = chunk->keep;
+        size_t i = 0;
+
+#if defined(BUFFER_SIMD_AVX2)
+        {
+                const __m256i lo = _mm256_set1_epi16((int16_t)(min_y - 1));
+                const __m256i hi = _mm256_set1_epi16((int16_t)max_y);
+                const __m256i one = _mm256_set1_epi16(1);
+                for(; i + 16 <= num_bullets; i += 16)
+                {
+                        __m256i py = _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)(y + i)),
+                                                      _mm256_loadu_si256((const __m256i*)(dir + i)));
+                        _mm256_storeu_si256((__m256i*)(y + i), py);
+
+                        __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi16(py, lo), _mm256_cmpgt_epi16(hi, py));
+                        // Narrow the 16-bit lanes to 0/1 bytes; packing works per
+                        // 128-bit half, so gather the two halves' low quadwords
+                        __m256i packed = _mm256_packs_epi16(_mm256_and_si256(inside, one), _mm256_setzero_si256());
+                        packed = _mm256_permute4x64_epi64(packed, 0x08);
+                        _mm_storeu_si128((__m128i*)(keep + i), _mm256_castsi256_si128(packed));
+                }
+        }
+#endif
+
+#if defined(BUFFER_SIMD_AVX2) || defined(BUFFER_SIMD_SSE2)
+        {
+                const __m128i lo = _mm_set1_epi16((int16_t)(min_y - 1));
+                const __m128i hi = _mm_set1_epi16((int16_t)max_y);
+                const __m128i one = _mm_set1_epi16(1);
+                for(; i + 8 <= num_bullets; i += 8)
+                {
+                        __m128i py = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(y + i)),
+                                                   _mm_loadu_si128((const __m128i*)(dir + i)));
+                        _mm_storeu_si128((__m128i*)(y + i), py);
+
+                        __m128i inside = _mm_and_si128(_mm_cmpgt_epi16(py, lo), _mm_cmpgt_epi16(hi, py));
+                        __m128i packed = _mm_packs_epi16(_mm_and_si128(inside, one), _mm_setzero_si128());
+                        _mm_storel_epi64((__m128i*)(keep + i), packed);
+                }
+        }
+#endif
+
+        for(; i < num_bullets; ++i)
+        {
+                y[i] += dir[i];
+                keep[i] = y[i] >= min_y && y[i] < max_y;
+        }
+}
+
+void bullet_pool_integrate(BulletPool* pool, int min_y, int max_y)
+{
+        for(size_t c = 0; c < pool->num_chunks; ++c)
+        {
+                bullet_chunk_integrate(pool->chunks[c], bullet_pool_chunk_size(pool, c), min_y, max_y);
+        }
+}
+
+// Removes the bullets whose keep flag is clear, preserving the order of
+// the others, and frees their slots
+void bullet_pool_compact(BulletPool* pool)
+{
+        size_t out = 0;
+        for(size_t i = 0; i < pool->num_bullets; ++i)
+        {
+                BulletChunk* chunk = pool->chunks[i / BULLET_CHUNK_SIZE];
+                size_t offset = i % BULLET_CHUNK_SIZE;
+                uint32_t slot = chunk->slot[offset];
+
+                if(!chunk->keep[offset])
+                {
+                        ++pool->slot_generation[slot];
+                        pool->slot_index[slot] = pool->free_slot;
+                        pool->free_slot = slot;
+                        continue;
+                }
+
+                BulletChunk* out_chunk = pool->chunks[out / BULLET_CHUNK_SIZE];
+                size_t out_offset = out % BULLET_CHUNK_SIZE;
+                out_chunk->x[out_offset] = chunk->x[offset];
+                out_chunk->y[out_offset] = chunk->y[offset];
+                out_chunk->dir[out_offset] = chunk->dir[offset];
+                out_chunk->slot[out_offset] = slot;
+                pool->slot_index[slot] = (uint32_t)out;
+                ++out;
+        }
+        pool->num_bullets = out;
+        pool->num_moved = out;
+}
+
+// Records every bullet, alpha in [0, 1] places the ones that moved in the
+// last tick between their position before it and the current one. Bullets
+// spawned since are drawn at their spawn position.
+void bullet_pool_draw(const BulletPool* pool, DrawList* list, const Sprite& sprite, uint32_t color, float alpha)
+{
+        float back = 1.0f - alpha;
+        for(size_t c = 0; c < pool->num_chunks; ++c)
+        {
+                const BulletChunk* chunk = pool->chunks[c];
+                size_t num_bullets = bullet_pool_chunk_size(pool, c);
+                for(size_t i = 0; i < num_bullets; ++i)
+                {
+                        int y = chunk->y[i];
+                        if(c * BULLET_CHUNK_SIZE + i < pool->num_moved)
+                        {
+                                y -= (int)(back * chunk->dir[i] + 0.5f);
+                                if(y < 0) y = 0;
+                        }
+                        draw_list_sprite(list, sprite, chunk->x[i], y, color);
+                }
+        }
+}
+
+// Returns the lowest index of a live alien that sprite at (x, y) overlaps,
+// or COLLISION_NO_HIT, by testing every alien. The sprite rectangle is
+// compared against the 16-bit alien coordinates a whole vector of aliens
+// at a time, using the largest live alien sprite as the extent of every
+// alien. Only the few aliens that pass get the exact mask test.
+size_t aliens_find_hit(const Aliens* aliens, size_t num_aliens, const Sprite* const* type_sprites,
+                       const Sprite& sprite, size_t x, size_t y)
+{
+        size_t max_width = 0, max_height = 0;
+        for(size_t type = ALIEN_TYPE_A; type <= ALIEN_TYPE_C; ++type)
+        {
+                if(type_sprites[type]->width > max_width) max_width = type_sprites[type]->width;
+                if(type_sprites[type]->height > max_height) max_height = type_sprites[type]->height;
+        }
+
+        // An alien at (ax, ay) is a candidate when
+        // min_x < ax < max_x and min_y < ay < max_y
+        int min_x = (int)x - (int)max_width;
+        int min_y = (int)y - (int)max_height;
+        int max_x = (int)(x + sprite.width);
+        int max_y = (int)(y + sprite.height);
+
+        size_t i = 0;
+
+#if defined(BUFFER_SIMD_AVX2)
+        {
+                const __m256i lo_x = _mm256_set1_epi16((int16_t)min_x);
+                const __m256i lo_y = _mm256_set1_epi16((int16_t)min_y);
+                const __m256i hi_x = _mm256_set1_epi16((int16_t)max_x);
+                const __m256i hi_y = _mm256_set1_epi16((int16_t)max_y);
+                const __m256i dead = _mm256_setzero_si256();
+                for(; i + 16 <= num_aliens; i += 16)
+                {
+                        __m256i ax = _mm256_loadu_si256((const __m256i*)(aliens->x + i));
+                        __m256i ay = _mm256_loadu_si256((const __m256i*)(aliens->y + i));
+                        __m256i type = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(aliens->type + i)));
+
+                        __m256i candidate = _mm256_andnot_si256(
+                                _mm256_cmpeq_epi16(type, dead),
+                                _mm256_and_si256(
+                                        _mm256_and_si256(_mm256_cmpgt_epi16(ax, lo_x), _mm256_cmpgt_epi16(hi_x, ax)),
+                                        _mm256_and_si256(_mm256_cmpgt_epi16(ay, lo_y), _mm256_cmpgt_epi16(hi_y, ay))));
+                        // Two mask bits per 16-bit lane
+                        int mask = _mm256_movemask_epi8(candidate);
+                        if(!mask) continue;
+
+                        for(int lane = 0; lane < 16; ++lane)
+                        {
+                                if(!(mask & (1 << (2 * lane)))) continue;
+                                size_t ai = i + lane;
+                                if(sprite_overlap_check(sprite, x, y, *type_sprites[aliens->type[ai]], aliens->x[ai], aliens->y[ai]))
+                                {
+                                        return ai;
+                                }
+                        }
+                }
+        }
+#endif
+
+#if defined(BUFFER_SIMD_AVX2) || defined(BUFFER_SIMD_SSE2)
+        {
+                const __m128i lo_x = _mm_set1_epi16((int16_t)min_x);
+                const __m128i lo_y = _mm_set1_epi16((int16_t)min_y);
+                const __m128i hi_x = _mm_set1_epi16((int16_t)max_x);
+                const __m128i hi_y = _mm_set1_epi16((int16_t)max_y);
+                const __m128i dead = _mm_setzero_si128();
+                for(; i + 8 <= num_aliens; i += 8)
+                {
+                        __m128i ax = _mm_loadu_si128((const __m128i*)(aliens->x + i));
+                        __m128i ay = _mm_loadu_si128((const __m128i*)(aliens->y + i));
+                        __m128i type = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(aliens->type + i)), dead);
+
+                        __m128i candidate = _mm_andnot_si128(
+                                _mm_cmpeq_epi16(type, dead),
+                                _mm_and_si128(
+                                        _mm_and_si128(_mm_cmpgt_epi16(ax, lo_x), _mm_cmpgt_epi16(hi_x, ax)),
+                                        _mm_and_si128(_mm_cmpgt_epi16(ay, lo_y), _mm_cmpgt_epi16(hi_y, ay))));
+                        // Two mask bits per 16-bit lane
+                        int mask = _mm_movemask_epi8(candidate);
+                        if(!mask) continue;
+
+                        for(int lane = 0; lane < 8; ++lane)
+                        {
+                                if(!(mask & (1 << (2 * lane)))) continue;
+                                size_t ai = i + lane;
+                                if(sprite_overlap_check(sprite, x, y, *type_sprites[aliens->type[ai]], aliens->x[ai], aliens->y[ai]))
+                                {
+                                        return ai;
+                                }
+                        }
+                }
+        }
+#endif
+
+        for(; i < num_aliens; ++i)
+        {
+                uint8_t type = aliens->type[i];
+                if(type == ALIEN_DEAD) continue;
+
+                int ax = aliens->x[i];
+                int ay = aliens->y[i];
+                if(ax > min_x && ax < max_x && ay > min_y && ay < max_y &&
+                   sprite_overlap_check(sprite, x, y, *type_sprites[type], ax, ay))
+                {
+                        return i;
+                }
+        }
+
+        return COLLISION_NO_HIT;
+}
+
+void collision_grid_init(CollisionGrid* grid, size_t width, size_t height)
+{
+        grid->num_cols = (width + COLLISION_CELL_SIZE - 1) / COLLISION_CELL_SIZE;
+        grid->num_rows = (height + COLLISION_CELL_SIZE - 1) / COLLISION_CELL_SIZE;
+        grid->cell_offsets = new uint32_t[grid->num_cols * grid->num_rows + 1];
+        grid->capacity = 256;
+        grid->cell_aliens = new uint32_t[grid->capacity];
+        grid->queries = 0;
+        grid->candidates = 0;
+}
+
+void collision_grid_destroy(CollisionGrid* grid)
+{
+        delete[] grid->cell_offsets;
+        delete[] grid->cell_aliens;
+        grid->cell_offsets = grid->cell_aliens = 0;
+}
+
+// Returns the cells [col_begin, col_end) x [row_begin, row_end) the
+// rectangle overlaps, clamped to the grid
+void collision_grid_cells(const CollisionGrid* grid, size_t x, size_t y, size_t width, size_t height,
+                          size_t* col_begin, size_t* col_end, size_t* row_begin, size_t* row_end)
+{
+        *col_begin = x / COLLISION_CELL_SIZE;
+        *row_begin = y / COLLISION_CELL_SIZE;
+        *col_end = (x + width + COLLISION_CELL_SIZE - 1) / COLLISION_CELL_SIZE;
+        *row_end = (y + height + COLLISION_CELL_SIZE - 1) / COLLISION_CELL_SIZE;
+        if(*col_end > grid->num_cols) *col_end = grid->num_cols;
+        if(*row_end > grid->num_rows) *row_end = grid->num_rows;
+        if(*col_begin > *col_end) *col_begin = *col_end;
+        if(*row_begin > *row_end) *row_begin = *row_end;
+}
+
+// Rebuilds the grid from the live aliens. type_sprites[type] is the
+// current sprite of every alien type.
+void collision_grid_build(CollisionGrid* grid, const Aliens* aliens, size_t num_aliens,
+                          const Sprite* const* type_sprites)
+{
+        size_t num_cells = grid->num_cols * grid->num_rows;
+        uint32_t* offsets = grid->cell_offsets;
+        for(size_t cell = 0; cell <= num_cells; ++cell)
+        {
+                offsets[cell] = 0;
+        }
+
+        // Count the aliens of each cell, then turn counts into offsets
+        size_t num_entries = 0;
+        for(size_t ai = 0; ai < num_aliens; ++ai)
+        {
+                if(aliens->type[ai] == ALIEN_DEAD) continue;
+
+                const Sprite& sprite = *type_sprites[aliens->type[ai]];
+                size_t col_begin, col_end, row_begin, row_end;
+                collision_grid_cells(grid, aliens->x[ai], aliens->y[ai], sprite.width, sprite.height,
+                                     &col_begin, &col_end, &row_begin, &row_end);
+                for(size_t row = row_begin; row < row_end; ++row)
+                {
+                        for(size_t col = col_begin; col < col_end; ++col)
+                        {
+                                ++offsets[row * grid->num_cols + col + 1];
+                        }
+                }
+                num_entries += (row_end - row_begin) * (col_end - col_begin);
+        }
+
+        for(size_t cell = 0; cell < num_cells; ++cell)
+        {
+                offsets[cell + 1] += offsets[cell];
+        }
+
+        if(num_entries > grid->capacity)
+        {
+                delete[] grid->cell_aliens;
+                grid->capacity = 2 * num_entries;
+                grid->cell_aliens = new uint32_t[grid->capacity];
+        }
+
+        for(size_t ai = 0; ai < num_aliens; ++ai)
+        {
+                if(aliens->type[ai] == ALIEN_DEAD) continue;
+
+                const Sprite& sprite = *type_sprites[aliens->type[ai]];
+                size_t col_begin, col_end, row_begin, row_end;
+                collision_grid_cells(grid, aliens->x[ai], aliens->y[ai], sprite.width, sprite.height,
+                                     &col_begin, &col_end, &row_begin, &row_end);
+                for(size_t row = row_begin; row < row_end; ++row)
+                {
+                        for(size_t col = col_begin; col < col_end; ++col)
+                        {
+                                grid->cell_aliens[offsets[row * grid->num_cols + col]++] = (uint32_t)ai;
+                        }
+                }
+        }
+
+        // The fill pass advanced every offset to the start of the next cell
+        for(size_t cell = num_cells; cell > 0; --cell)
+        {
+                offsets[cell] = offsets[cell - 1];
+        }
+        offsets[0] = 0;
+}
+
+// Returns the lowest index of a live alien that sprite at (x, y) overlaps,
+// or COLLISION_NO_HIT. Aliens killed since the grid was built are skipped.
+size_t collision_grid_find_hit(CollisionGrid* grid, const Aliens* aliens, const Sprite* const* type_sprites,
+                               const Sprite& sprite, size_t x, size_t y)
+{
+        size_t col_begin, col_end, row_begin, row_end;
+        collision_grid_cells(grid, x, y, sprite.width, sprite.height,
+                             &col_begin, &col_end, &row_begin, &row_end);
+
+        size_t hit = COLLISION_NO_HIT;
+        for(size_t row = row_begin; row < row_end; ++row)
+        {
+                for(size_t col = col_begin; col < col_end; ++col)
+                {
+                        size_t cell = row * grid->num_cols + col;
+                        for(uint32_t i = grid->cell_offsets[cell]; i < grid->cell_offsets[cell + 1]; ++i)
+                        {
+                                size_t ai = grid->cell_aliens[i];
+                                if(ai >= hit) break;
+                                ++grid->candidates;
+
+                                uint8_t type = aliens->type[ai];
+                                if(type == ALIEN_DEAD) continue;
+
+                                if(sprite_overlap_check(sprite, x, y, *type_sprites[type], aliens->x[ai], aliens->y[ai]))
+                                {
+                                        hit = ai;
+                                        break;
+                                }
+                        }
+                }
+        }
+
+        ++grid->queries;
+        return hit;
+}
+
+void formation_init(Formation* formation, size_t num_cols, size_t num_rows,
+                    size_t origin_x, size_t origin_y, size_t spacing_x, size_t spacing_y,
+                    size_t cell_width, size_t cell_height)
+{
+        formation->num_cols = num_cols;
+        formation->num_rows = num_rows;
+        formation->origin_x = origin_x;
+        formation->origin_y = origin_y;
+        formation->spacing_x = spacing_x;
+        formation->spacing_y = spacing_y;
+        formation->cell_width = cell_width;
+        formation->cell_height = cell_height;
+
+        formation->column_alive = new size_t[num_cols];
+        formation->row_alive = new size_t[num_rows];
+        formation->queries = 0;
+        formation->tests = 0;
+}
+
+void formation_destroy(Formation* formation)
+{
+        delete[] formation->column_alive;
+        delete[] formation->row_alive;
+        formation->column_alive = formation->row_alive = 0;
+}
+
+// Recounts the live aliens of every column and row
+void formation_count(Formation* formation, const Aliens* aliens)
+{
+        for(size_t col = 0; col < formation->num_cols; ++col) formation->column_alive[col] = 0;
+        for(size_t row = 0; row < formation->num_rows; ++row) formation->row_alive[row] = 0;
+
+        for(size_t row = 0; row < formation->num_rows; ++row)
+        {
+                for(size_t col = 0; col < formation->num_cols; ++col)
+                {
+                        if(aliens->type[row * formation->num_cols + col] == ALIEN_DEAD) continue;
+                        ++formation->column_alive[col];
+                        ++formation->row_alive[row];
+                }
+        }
+}
+
+// Call when alien ai dies
+void formation_kill(Formation* formation, size_t ai)
+{
+        --formation->column_alive[ai % formation->num_cols];
+        --formation->row_alive[ai / formation->num_cols];
+}
+
+// Returns the cells [*begin, *end) along one axis whose span
+// [origin + i * spacing, origin + i * spacing + cell_size) overlaps
+// [pos, pos + size)
+void formation_axis_cells(size_t pos, size_t size, size_t origin, size_t spacing, size_t cell_size,
+                          size_t num_cells, size_t* begin, size_t* end)
+{
+        *begin = pos >= origin + cell_size? (pos - origin - cell_size) / spacing + 1: 0;
+        *end = pos + size > origin? (pos + size - origin - 1) / spacing + 1: 0;
+        if(*end > num_cells) *end = num_cells;
+        if(*begin > *end) *begin = *end;
+}
+
+// Returns the lowest index of a live alien that sprite at (x, y) overlaps,
+// or COLLISION_NO_HIT. type_sprites[type] is the current sprite of every
+// alien type. Only the cells the sprite overlaps are tested, one cell for
+// a bullet.
+size_t formation_find_hit(Formation* formation, const Aliens* aliens, const Sprite* const* type_sprites,
+                          const Sprite& sprite, size_t x, size_t y)
+{
+        ++formation->queries;
+
+        size_t col_begin, col_end, row_begin, row_end;
+        formation_axis_cells(x, sprite.width, formation->origin_x, formation->spacing_x,
+                             formation->cell_width, formation->num_cols, &col_begin, &col_end);
+        formation_axis_cells(y, sprite.height, formation->origin_y, formation->spacing_y,
+                             formation->cell_height, formation->num_rows, &row_begin, &row_end);
+
+        for(size_t row = row_begin; row < row_end; ++row)
+        {
+                if(formation->row_alive[row] == 0) continue;
+
+                for(size_t col = col_begin; col < col_end; ++col)
+                {
+                        if(formation->column_alive[col] == 0) continue;
+
+                        size_t ai = row * formation->num_cols + col;
+                        uint8_t type = aliens->type[ai];
+                        if(type == ALIEN_DEAD) continue;
+
+                        ++formation->tests;
+                        if(sprite_overlap_check(sprite, x, y, *type_sprites[type], aliens->x[ai], aliens->y[ai]))
+                        {
+                                return ai;
+                        }
+                }
+        }
+
+        return COLLISION_NO_HIT;
+}
+
+void particle_system_init(ParticleSystem* system, size_t capacity, size_t width, size_t height)
+{
+        system->capacity = capacity;
+        system->num_particles = 0;
+        system->x = new float[capacity];
+        system->y = new float[capacity];
+        system->vx = new float[capacity];
+        system->vy = new float[capacity];
+        system->life = new float[capacity];
+
+        system->width = (float)width;
+        system->height = (float)height;
+        system->rng = 0x9E3779B9u;
+        system->num_moved = 0;
+
+        system->max_chunks = (capacity + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
+        system->chunk_survivors = new size_t[system->max_chunks];
+
+        system->spawned = 0;
+        system->dropped = 0;
+        system->peak = 0;
+        system->num_updates = 0;
+        system->update_seconds = 0;
+}
+
+void particle_system_destroy(ParticleSystem* system)
+{
+        delete[] system->x;
+        delete[] system->y;
+        delete[] system->vx;
+        delete[] system->vy;
+        delete[] system->life;
+        delete[] system->chunk_survivors;
+        system->num_particles = system->capacity = 0;
+}
+
+// Uniform in [0, 1), xorshift32
+float particle_random(ParticleSystem* system)
+{
+        uint32_t r = system->rng;
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        system->rng = r;
+        return (r >> 8) * (1.0f / 16777216.0f);
+}
+
+// Spawns count particles at (x, y) flying off in random directions,
+// biased upwards, at up to speed pixels per frame
+void particle_system_burst(ParticleSystem* system, float x, float y, size_t count, float speed)
+{
+        size_t available = system->capacity - system->num_particles;
+        if(count > available)
+        {
+                system->dropped += count - available;
+                count = available;
+        }
+
+        for(size_t i = system->num_particles; i < system->num_particles + count; ++i)
+        {
+                system->x[i] = x;
+                system->y[i] = y;
+                system->vx[i] = (2.0f * particle_random(system) - 1.0f) * speed;
+                system->vy[i] = (2.0f * particle_random(system) - 0.5f) * speed;
+                system->life[i] = 16.0f + 24.0f * particle_random(system);
+        }
+
+        system->num_particles += count;
+        system->spawned += count;
+        if(system->num_particles > system->peak) system->peak = system->num_particles;
+}
+
+// Moves the survivors of [begin, end) to the front of the range, after
+// advancing them by one frame. Returns the number of survivors.
+size_t particle_update_range(ParticleSystem* system, size_t begin, size_t end)
+{
+        float* x = system->x;
+        float* y = system->y;
+        float* vx = system->vx;
+        float* vy = system->vy;
+        float* life = system->life;
+
+        // Survivors are written at out, which never passes the particle
+        // being read, so the range is compacted in place
+        size_t out = begin;
+        size_t i = begin;
+
+#if defined(BUFFER_SIMD_AVX2)
+        {
+                const __m256 gravity = _mm256_set1_ps(PARTICLE_GRAVITY);
+                const __m256 one = _mm256_set1_ps(1.0f);
+                const __m256 zero = _mm256_setzero_ps();
+                const __m256 width = _mm256_set1_ps(system->width);
+                const __m256 height = _mm256_set1_ps(system->height);
+                for(; i + 8 <= end; i += 8)
+                {
+                        __m256 px = _mm256_loadu_ps(x + i);
+                        __m256 py = _mm256_loadu_ps(y + i);
+                        __m256 pvx = _mm256_loadu_ps(vx + i);
+                        __m256 pvy = _mm256_sub_ps(_mm256_loadu_ps(vy + i), gravity);
+                        __m256 plife = _mm256_sub_ps(_mm256_loadu_ps(life + i), one);
+                        px = _mm256_add_ps(px, pvx);
+                        py = _mm256_add_ps(py, pvy);
+
+                        __m256 alive = _mm256_and_ps(
+                                _mm256_and_ps(_mm256_cmp_ps(plife, zero, _CMP_GT_OQ),
+                                              _mm256_cmp_ps(px, zero, _CMP_GE_OQ)),
+                                _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(px, width, _CMP_LT_OQ),
+                                                            _mm256_cmp_ps(py, zero, _CMP_GE_OQ)),
+                                              _mm256_cmp_ps(py, height, _CMP_LT_OQ)));
+                        int mask = _mm256_movemask_ps(alive);
+
+                        if(mask == 0xFF)
+                        {
+                                _mm256_storeu_ps(x + out, px);
+                                _mm256_storeu_ps(y + out, py);
+                                _mm256_storeu_ps(vx + out, pvx);
+                                _mm256_storeu_ps(vy + out, pvy);
+                                _mm256_storeu_ps(life + out, plife);
+                                out += 8;
+                        }
+                        else if(mask)
+                        {
+                                float lanes[5][8];
+                                _mm256_storeu_ps(lanes[0], px);
+                                _mm256_storeu_ps(lanes[1], py);
+                                _mm256_storeu_ps(lanes[2], pvx);
+                                _mm256_storeu_ps(lanes[3], pvy);
+                                _mm256_storeu_ps(lanes[4], plife);
+                                for(int lane = 0; lane < 8; ++lane)
+                                {
+                                        if(!(mask & (1 << lane))) continue;
+                                        x[out] = lanes[0][lane];
+                                        y[out] = lanes[1][lane];
+                                        vx[out] = lanes[2][lane];
+                                        vy[out] = lanes[3][lane];
+                                        life[out] = lanes[4][lane];
+                                        ++out;
+                                }
+                        }
+                }
+        }
+#endif
+
+#if defined(BUFFER_SIMD_AVX2) || defined(BUFFER_SIMD_SSE2)
+        {
+                const __m128 gravity = _mm_set1_ps(PARTICLE_GRAVITY);
+                const __m128 one = _mm_set1_ps(1.0f);
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 width = _mm_set1_ps(system->width);
+                const __m128 height = _mm_set1_ps(system->height);
+                for(; i + 4 <= end; i += 4)
+                {
+                        __m128 px = _mm_loadu_ps(x + i);
+                        __m128 py = _mm_loadu_ps(y + i);
+                        __m128 pvx = _mm_loadu_ps(vx + i);
+                        __m128 pvy = _mm_sub_ps(_mm_loadu_ps(vy + i), gravity);
+                        __m128 plife = _mm_sub_ps(_mm_loadu_ps(life + i), one);
+                        px = _mm_add_ps(px, pvx);
+                        py = _mm_add_ps(py, pvy);
+
+                        __m128 alive = _mm_and_ps(
+                                _mm_and_ps(_mm_cmpgt_ps(plife, zero), _mm_cmpge_ps(px, zero)),
+                                _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(px, width), _mm_cmpge_ps(py, zero)),
+                                           _mm_cmplt_ps(py, height)));
+                        int mask = _mm_movemask_ps(alive);
+
+                        if(mask == 0xF)
+                        {
+                                _mm_storeu_ps(x + out, px);
+                                _mm_storeu_ps(y + out, py);
+                                _mm_storeu_ps(vx + out, pvx);
+                                _mm_storeu_ps(vy + out, pvy);
+                                _mm_storeu_ps(life + out, plife);
+                                out += 4;
+                        }
+                        else if(mask)
+                        {
+                                float lanes[5][4];
+                                _mm_storeu_ps(lanes[0], px);
+                                _mm_storeu_ps(lanes[1], py);
+                                _mm_storeu_ps(lanes[2], pvx);
+                                _mm_storeu_ps(lanes[3], pvy);
+                                _mm_storeu_ps(lanes[4], plife);
+                                for(int lane = 0; lane < 4; ++lane)
+                                {
+                                        if(!(mask & (1 << lane))) continue;
+                                        x[out] = lanes[0][lane];
+                                        y[out] = lanes[1][lane];
+                                        vx[out] = lanes[2][lane];
+                                        vy[out] = lanes[3][lane];
+                                        life[out] = lanes[4][lane];
+                                        ++out;
+                                }
+                        }
+                }
+        }
+#endif
+
+        for(; i < end; ++i)
+        {
+                float pvy = vy[i] - PARTICLE_GRAVITY;
+                float plife = life[i] - 1.0f;
+                float px = x[i] + vx[i];
+                float py = y[i] + pvy;
+                if(!(plife > 0.0f && px >= 0.0f && px < system->width && py >= 0.0f && py < system->height)) continue;
+
+                x[out] = px;
+                y[out] = py;
+                vx[out] = vx[i];
+                vy[out] = pvy;
+                life[out] = plife;
+                ++out;
+        }
+
+        return out - begin;
+}
+
+struct ParticleJob
+{
+        ParticleSystem* system;
+        size_t chunk_size;
+};
+
+size_t particle_job_run_chunk(void* job, size_t chunk)
+{
+        const ParticleJob* particles = (const ParticleJob*)job;
+        ParticleSystem* system = particles->system;
+        size_t begin = chunk * particles->chunk_size;
+        size_t end = begin + particles->chunk_size;
+        if(end > system->num_particles) end = system->num_particles;
+
+        size_t survivors = particle_update_range(system, begin, end);
+        system->chunk_survivors[chunk] = survivors;
+        return survivors;
+}
+
+// Advances all particles by one frame and culls the dead ones. With
+// worker threads in pool the particles are updated in chunks, whose
+// survivors are then moved together.
+void particle_system_update(ParticleSystem* system, WorkerPool* pool)
+{
+        auto start = std::chrono::steady_clock::now();
+
+        size_t num_particles = system->num_particles;
+        ParticleJob job = {system, num_particles};
+        size_t num_chunks = 1;
+        if(pool->num_workers > 0 && num_particles > PARTICLE_CHUNK_SIZE)
+        {
+                job.chunk_size = PARTICLE_CHUNK_SIZE;
+                num_chunks = (num_particles + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
+        }
+
+        if(num_particles > 0)
+        {
+                worker_pool_execute(pool, particle_job_run_chunk, &job, num_chunks);
+        }
+        else
+        {
+                system->chunk_survivors[0] = 0;
+        }
+
+        size_t out = system->chunk_survivors[0];
+        for(size_t chunk = 1; chunk < num_chunks; ++chunk)
+        {
+                size_t begin = chunk * job.chunk_size;
+                size_t count = system->chunk_survivors[chunk];
+                memmove(system->x + out, system->x + begin, count * sizeof(float));
+                memmove(system->y + out, system->y + begin, count * sizeof(float));
+                memmove(system->vx + out, system->vx + begin, count * sizeof(float));
+                memmove(system->vy + out, system->vy + begin, count * sizeof(float));
+                memmove(system->life + out, system->life + begin, count * sizeof(float));
+                out += count;
+        }
+        system->num_particles = out;
+        system->num_moved = out;
+
+        system->update_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++system->num_updates;
+}
+
+// Records every particle as a point of the entity layer. alpha in [0, 1]
+// places the ones that moved in the last update between their position
+// before it and the current one.
+void particle_system_draw(const ParticleSystem* system, DrawList* list, uint32_t color, float alpha)
+{
+        DrawPoint* points = draw_list_reserve_points(list, system->num_particles);
+
+        // Particles spawned since the update have no previous position and
+        // are drawn where they are
+        size_t num_moved = alpha < 1.0f? system->num_moved: 0;
+        float back = 1.0f - alpha;
+        float max_x = system->width - 1.0f;
+        float max_y = system->height - 1.0f;
+        for(size_t i = 0; i < num_moved; ++i)
+        {
+                float x = system->x[i] - back * system->vx[i];
+                float y = system->y[i] - back * system->vy[i];
+                points[i].x = (uint16_t)(x < 0? 0: x > max_x? max_x: x);
+                points[i].y = (uint16_t)(y < 0? 0: y > max_y? max_y: y);
+                points[i].color = color;
+        }
+        for(size_t i = num_moved; i < system->num_particles; ++i)
+        {
+                points[i].x = (uint16_t)system->x[i];
+                points[i].y = (uint16_t)system->y[i];
+                points[i].color = color;
+        }
+}
+
+// Current sprite of every alien type, follows the animations
+void game_update_type_sprites(Game* game)
+{
+        game->alien_type_sprites[ALIEN_DEAD] = &alien_death_sprite;
+        for(size_t i = 0; i < 3; ++i)
+        {
+                const SpriteAnimation& animation = game->alien_animation[i];
+                size_t current_frame = game->state.animation_time[i] / animation.frame_duration;
+                game->alien_type_sprites[i + 1] = animation.frames[current_frame];
+        }
+}
+
+void game_init(Game* game, const GameConfig& config)
+{
+        game->width = config.width;
+        game->height = config.height;
+        game->collision_mode = config.collision_mode;
+        game->num_sim_workers = config.num_sim_workers;
+        game->particle_stress = config.particle_stress;
+        game->bullet_stress = config.bullet_stress;
+
+        // Zeroed padding included, so snapshots of equal states compare equal
+        memset(&game->state, 0, sizeof(GameState));
+        game->state.bullet_stress_column = 0;
+
+        game->alien_animation = alien_animations;
+        for(size_t i = 0; i < 3; ++i) game->state.animation_time[i] = 0;
+        game_update_type_sprites(game);
+
+        bullet_pool_init(&game->bullets, game->bullet_stress + 1);
+        game->state.num_aliens = FORMATION_COLS * FORMATION_ROWS;
+        for(size_t ai = 0; ai < GAME_MAX_ALIENS; ++ai)
+        {
+                game->state.aliens.x[ai] = game->state.aliens.y[ai] = 0;
+                game->state.aliens.type[ai] = ALIEN_DEAD;
+                game->state.aliens.death_timer[ai] = 0;
+        }
+
+        game->state.player.x = 112 - 5;
+        game->state.player.y = 32;
+        game->state.player.prev_x = game->state.player.x;
+
+        game->state.player.life = 3;
+
+        // Every alien sprite, and the death sprite that replaces it, fits
+        // in a 13x8 cell. Aliens are centered in their cell.
+        Formation* formation = &game->formation;
+        formation_init(formation, FORMATION_COLS, FORMATION_ROWS, 20, 128, 16, 17,
+                       alien_death_sprite.width, alien_sprites[0].height);
+
+        for(size_t yi = 0; yi < formation->num_rows; ++yi)
+        {
+                for(size_t xi = 0; xi < formation->num_cols; ++xi)
+                {
+                        size_t ai = yi * formation->num_cols + xi;
+                        uint8_t type = (5 - yi) / 2 + 1;
+
+                        const Sprite& sprite = alien_sprites[2 * (type - 1)];
+
+                        game->state.aliens.type[ai] = type;
+                        game->state.aliens.death_timer[ai] = 10;
+                        game->state.aliens.x[ai] = (uint16_t)(formation->origin_x + formation->spacing_x * xi + (formation->cell_width - sprite.width)/2);
+                        game->state.aliens.y[ai] = (uint16_t)(formation->origin_y + formation->spacing_y * yi);
+                }
+        }
+        formation_count(formation, &game->state.aliens);
+
+        size_t particle_capacity = PARTICLE_DEFAULT_CAPACITY;
+        if(game->particle_stress + PARTICLE_DEATH_BURST > particle_capacity)
+        {
+                particle_capacity = game->particle_stress + PARTICLE_DEATH_BURST;
+        }
+        particle_system_init(&game->particles, particle_capacity, game->width, game->height);
+
+        worker_pool_init(&game->sim_pool, game->num_sim_workers);
+
+        collision_grid_init(&game->collision_grid, game->width, game->height);
+
+        game->state.score = 0;
+        game->state.credits = 0;
+
+        game->text_runs = new TextRunCache;
+        text_run_cache_init(game->text_runs);
+
+        game->credit_text_value = game->state.credits;
+        snprintf(game->credit_text, sizeof(game->credit_text), "CREDIT %02zu", game->state.credits);
+
+        game->score_text_value = game->state.score;
+        snprintf(game->score_text, sizeof(game->score_text), "%zu", game->state.score);
+}
+
+void game_destroy(Game* game)
+{
+        bullet_pool_destroy(&game->bullets);
+        formation_destroy(&game->formation);
+        collision_grid_destroy(&game->collision_grid);
+        particle_system_destroy(&game->particles);
+        worker_pool_destroy(&game->sim_pool);
+        delete game->text_runs;
+        game->text_runs = 0;
+}
+
+// Records the state of the game into list. alpha in [0, 1] is how far
+// the frame lies between the last tick and the next, moving things are
+// drawn that far between their positions before and after the last tick.
+void game_draw(Game* game, DrawList* list, float alpha)
+{
+        uint32_t color = rgb_to_uint32(128, 0, 0);
+
+        text_run_cache_begin_frame(game->text_runs);
+        draw_list_set_layer(list, DRAW_LAYER_HUD);
+        draw_list_text_run(list, game->text_runs, text_spritesheet, "SCORE", 4, game->height - text_spritesheet.height - 7, color);
+
+        if(game->state.credits != game->credit_text_value)
+        {
+                game->credit_text_value = game->state.credits;
+                snprintf(game->credit_text, sizeof(game->credit_text), "CREDIT %02zu", game->state.credits);
+        }
+        draw_list_text_run(list, game->text_runs, text_spritesheet, game->credit_text, 164, 7, color);
+
+        // Digits are the same glyphs in the text spritesheet
+        if(game->state.score != game->score_text_value)
+        {
+                game->score_text_value = game->state.score;
+                snprintf(game->score_text, sizeof(game->score_text), "%zu", game->state.score);
+        }
+        draw_list_text_run(list, game->text_runs, text_spritesheet, game->score_text, 4 + 2 * number_spritesheet.width, game->height - 2 * number_spritesheet.height - 12, color);
+
+        /* Draw a solid line across the screen */
+        draw_list_set_layer(list, DRAW_LAYER_BACKGROUND);
+        draw_list_fill_rect(list, 0, 16, game->width, 1, color);
+
+        draw_list_set_layer(list, DRAW_LAYER_ENTITIES);
+
+        const Aliens& aliens = game->state.aliens;
+        for(size_t ai = 0; ai < game->state.num_aliens; ++ai)
+        {
+                if(!aliens.death_timer[ai]) continue;
+
+                draw_list_sprite(list, *game->alien_type_sprites[aliens.type[ai]], aliens.x[ai], aliens.y[ai], color);
+        }
+
+        bullet_pool_draw(&game->bullets, list, bullet_sprite, color, alpha);
+
+        const Player& player = game->state.player;
+        size_t player_x = player.prev_x + (long)(alpha * ((long)player.x - (long)player.prev_x) + (player.x >= player.prev_x? 0.5f: -0.5f));
+        draw_list_sprite(list, player_sprite, player_x, player.y, color);
+
+        particle_system_draw(&game->particles, list, color, alpha);
+}
+
+// Advances the game by one tick
+void game_update(Game* game, const GameInput& input)
+{
+        /* Update animations */
+        for(size_t i = 0; i < 3; ++i)
+        {
+                const SpriteAnimation& animation = game->alien_animation[i];
+                size_t& time = game->state.animation_time[i];
+                ++time;
+                if(time == animation.num_frames * animation.frame_duration)
+                {
+                        time = 0;
+                }
+        }
+        game_update_type_sprites(game);
+
+        // Simulate aliens
+        Aliens& aliens = game->state.aliens;
+        for(size_t ai = 0; ai < game->state.num_aliens; ++ai)
+        {
+                aliens.death_timer[ai] -= aliens.type[ai] == ALIEN_DEAD && aliens.death_timer[ai];
+        }
+
+        // Simulate particles
+        ParticleSystem* particles = &game->particles;
+        while(particles->num_particles < game->particle_stress)
+        {
+                float x = particle_random(particles) * game->width;
+                float y = particle_random(particles) * game->height;
+                particle_system_burst(particles, x, y, PARTICLE_DEATH_BURST, 1.0f);
+        }
+        particle_system_update(particles, &game->sim_pool);
+
+        /* Simulate the bullets */
+        const Sprite* const* type_sprites = game->alien_type_sprites;
+        if(game->collision_mode == COLLISION_GRID)
+        {
+                collision_grid_build(&game->collision_grid, &aliens, game->state.num_aliens, type_sprites);
+        }
+
+        // Move the bullets and flag the ones that left the playfield
+        BulletPool* bullets = &game->bullets;
+        bullet_pool_begin_tick(bullets);
+        bullet_pool_integrate(bullets, bullet_sprite.height, game->height);
+
+        // Find what every bullet hits; only reads the aliens
+        for(size_t c = 0; c < bullets->num_chunks; ++c)
+        {
+                BulletChunk* chunk = bullets->chunks[c];
+                size_t num_bullets = bullet_pool_chunk_size(bullets, c);
+                for(size_t bi = 0; bi < num_bullets; ++bi)
+                {
+                        chunk->hit[bi] = COLLISION_NO_HIT;
+                        if(!chunk->keep[bi]) continue;
+
+                        size_t x = chunk->x[bi];
+                        size_t y = chunk->y[bi];
+                        switch(game->collision_mode)
+                        {
+                        case COLLISION_GRID:
+                                chunk->hit[bi] = collision_grid_find_hit(&game->collision_grid, &aliens, type_sprites,
+                                                                         bullet_sprite, x, y);
+                                break;
+                        case COLLISION_SCAN:
+                                chunk->hit[bi] = aliens_find_hit(&aliens, game->state.num_aliens, type_sprites,
+                                                                 bullet_sprite, x, y);
+                                break;
+                        default:
+                                chunk->hit[bi] = formation_find_hit(&game->formation, &aliens, type_sprites,
+                                                                    bullet_sprite, x, y);
+                                break;
+                        }
+                }
+        }
+
+        // Apply the hits in firing order. A bullet kills at most one
+        // alien and an alien goes to the first bullet hitting it, the
+        // other bullets fly on.
+        for(size_t c = 0; c < bullets->num_chunks; ++c)
+        {
+                BulletChunk* chunk = bullets->chunks[c];
+                size_t num_bullets = bullet_pool_chunk_size(bullets, c);
+                for(size_t bi = 0; bi < num_bullets; ++bi)
+                {
+                        size_t ai = chunk->hit[bi];
+                        if(ai == COLLISION_NO_HIT || aliens.type[ai] == ALIEN_DEAD) continue;
+
+                        uint8_t type = aliens.type[ai];
+                        const Sprite& alien_sprite = *type_sprites[type];
+                        game->state.score += 10 * (4 - type);
+                        particle_system_burst(particles,
+                                              aliens.x[ai] + 0.5f * alien_sprite.width,
+                                              aliens.y[ai] + 0.5f * alien_sprite.height,
+                                              PARTICLE_DEATH_BURST, 1.0f);
+                        aliens.type[ai] = ALIEN_DEAD;
+                        formation_kill(&game->formation, ai);
+                        // NOTE: Hack to recenter death sprite
+                        aliens.x[ai] -= (alien_death_sprite.width - alien_sprite.width)/2;
+
+                        chunk->keep[bi] = 0;
+                }
+        }
+
+        bullet_pool_compact(bullets);
+
+        // Simulate player
+        game->state.player.prev_x = game->state.player.x;
+        int player_move_dir = 2 * input.move_dir;
+
+        if(player_move_dir != 0)
+        {
+                if(game->state.player.x + player_sprite.width + player_move_dir >= game->width)
+                {
+                        game->state.player.x = game->width - player_sprite.width;
+                }
+                else if((int)game->state.player.x + player_move_dir <= 0)
+                {
+                        game->state.player.x = 0;
+                }
+                else game->state.player.x += player_move_dir;
+        }
+
+        // Process events
+        if(input.fire)
+        {
+                bullet_pool_spawn(bullets, game->state.player.x + player_sprite.width / 2,
+                                  game->state.player.y + player_sprite.height, 2);
+        }
+
+        // Stress scenario: bullets fired from columns spread over the playfield
+        while(bullets->num_bullets < game->bullet_stress)
+        {
+                game->state.bullet_stress_column = (game->state.bullet_stress_column + 37) % game->width;
+                bullet_pool_spawn(bullets, game->state.bullet_stress_column, game->state.player.y + player_sprite.height, 2);
+        }
+        bullet_pool_end_tick(bullets);
+}
+
+void game_print_stats(const Game* game)
+{
+        const ParticleSystem& particles = game->particles;
+        if(particles.num_updates > 0)
+        {
+                printf("Particles: %zu peak, %llu spawned, %llu dropped, %.3f ms update per frame on %zu threads\n",
+                       particles.peak, (unsigned long long)particles.spawned, (unsigned long long)particles.dropped,
+                       1000.0 * particles.update_seconds / particles.num_updates, game->num_sim_workers + 1);
+        }
+
+        const BulletPool& bullets = game->bullets;
+        if(bullets.num_ticks > 0)
+        {
+                printf("Bullets: %zu peak overall, %.1f per-tick peak on average, %zu chunks of %d\n",
+                       bullets.peak, (double)bullets.frame_peak_total / bullets.num_ticks,
+                       bullets.num_chunks, BULLET_CHUNK_SIZE);
+        }
+
+        if(game->formation.queries > 0)
+        {
+                printf("Formation lookup: %llu queries, %.3f exact tests per query\n",
+                       (unsigned long long)game->formation.queries,
+                       (double)game->formation.tests / game->formation.queries);
+        }
+
+        if(game->collision_grid.queries > 0)
+        {
+                printf("Collision grid: %llu queries, %.3f candidates per query (brute force: %zu)\n",
+                       (unsigned long long)game->collision_grid.queries,
+                       (double)game->collision_grid.candidates / game->collision_grid.queries, game->state.num_aliens);
+        }
+
+        printf("Text runs: %llu hits, %llu misses\n",
+               (unsigned long long)game->text_runs->hits, (unsigned long long)game->text_runs->misses);
+}
+
+// FNV-1a over size bytes, continuing from hash
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+        const uint8_t* bytes = (const uint8_t*)data;
+        for(size_t i = 0; i < size; ++i)
+        {
+                hash ^= bytes[i];
+                hash *= 0x100000001B3ull;
+        }
+        return hash;
+}
+
+// Hash of everything that decides how the game continues, to check that
+// two runs fed the same input ended up in the same state. Counters and
+// caches are left out.
+uint64_t game_state_hash(const Game* game)
+{
+        uint64_t hash = 0xCBF29CE484222325ull;
+        hash = hash_bytes(hash, &game->state.aliens, sizeof(game->state.aliens));
+
+        uint64_t values[] = {
+                game->state.num_aliens, game->state.player.x, game->state.player.y, game->state.player.life,
+                game->state.score, game->state.credits, game->state.bullet_stress_column,
+                game->state.animation_time[0], game->state.animation_time[1], game->state.animation_time[2],
+                game->bullets.num_bullets, game->particles.num_particles, game->particles.rng
+        };
+        hash = hash_bytes(hash, values, sizeof(values));
+
+        const BulletPool& bullets = game->bullets;
+        for(size_t c = 0; c < bullets.num_chunks; ++c)
+        {
+                size_t num_bullets = bullet_pool_chunk_size(&bullets, c);
+                hash = hash_bytes(hash, bullets.chunks[c]->x, num_bullets * sizeof(int16_t));
+                hash = hash_bytes(hash, bullets.chunks[c]->y, num_bullets * sizeof(int16_t));
+                hash = hash_bytes(hash, bullets.chunks[c]->dir, num_bullets * sizeof(int16_t));
+        }
+
+        const ParticleSystem& particles = game->particles;
+        size_t particle_bytes = particles.num_particles * sizeof(float);
+        hash = hash_bytes(hash, particles.x, particle_bytes);
+        hash = hash_bytes(hash, particles.y, particle_bytes);
+        hash = hash_bytes(hash, particles.vx, particle_bytes);
+        hash = hash_bytes(hash, particles.vy, particle_bytes);
+        hash = hash_bytes(hash, particles.life, particle_bytes);
+
+        return hash;
+}
+
+/* Snapshots and saved states
+ *
+ * A snapshot is the GameState block plus the bullets and particles copied
+ * out of their pools. A saved state, the blob of a replay keyframe, is a
+ * snapshot followed by whatever overflowed it. Anything derived from these,
+ * the formation counts, the type sprites and the HUD text, is rebuilt on
+ * restore. Counters are not saved. A state only restores into a game
+ * initialized with the same config.
+ */
+
+// Fills snapshot, returns whether it holds every bullet and particle
+bool game_snapshot(const Game* game, GameSnapshot* snapshot)
+{
+        const BulletPool& bullets = game->bullets;
+        const ParticleSystem& particles = game->particles;
+        size_t num_bullets = bullets.num_bullets < GAME_SNAPSHOT_BULLETS? bullets.num_bullets: GAME_SNAPSHOT_BULLETS;
+        size_t num_particles = particles.num_particles < GAME_SNAPSHOT_PARTICLES? particles.num_particles: GAME_SNAPSHOT_PARTICLES;
+
+        snapshot->state = game->state;
+        snapshot->num_bullets = (uint32_t)bullets.num_bullets;
+        snapshot->num_particles = (uint32_t)particles.num_particles;
+        snapshot->particle_rng = particles.rng;
+
+        memcpy(snapshot->bullet_x, bullets.chunks[0]->x, num_bullets * sizeof(int16_t));
+        memcpy(snapshot->bullet_y, bullets.chunks[0]->y, num_bullets * sizeof(int16_t));
+        memcpy(snapshot->bullet_dir, bullets.chunks[0]->dir, num_bullets * sizeof(int16_t));
+
+        memcpy(snapshot->particle_x, particles.x, num_particles * sizeof(float));
+        memcpy(snapshot->particle_y, particles.y, num_particles * sizeof(float));
+        memcpy(snapshot->particle_vx, particles.vx, num_particles * sizeof(float));
+        memcpy(snapshot->particle_vy, particles.vy, num_particles * sizeof(float));
+        memcpy(snapshot->particle_life, particles.life, num_particles * sizeof(float));
+
+        return bullets.num_bullets == num_bullets && particles.num_particles == num_particles;
+}
+
+// Restores the block and the bullets and particles stored in it
+void game_restore_stored(Game* game, const GameSnapshot* snapshot)
+{
+        size_t num_bullets = snapshot->num_bullets < GAME_SNAPSHOT_BULLETS? snapshot->num_bullets: GAME_SNAPSHOT_BULLETS;
+        size_t num_particles = snapshot->num_particles < GAME_SNAPSHOT_PARTICLES? snapshot->num_particles: GAME_SNAPSHOT_PARTICLES;
+
+        game->state = snapshot->state;
+        game_update_type_sprites(game);
+        formation_count(&game->formation, &game->state.aliens);
+
+        // The restored bullets get new slots, handles from before turn stale
+        BulletPool* bullets = &game->bullets;
+        bullet_pool_clear(bullets);
+        for(size_t i = 0; i < num_bullets; ++i)
+        {
+                bullet_pool_spawn(bullets, snapshot->bullet_x[i], snapshot->bullet_y[i], snapshot->bullet_dir[i]);
+        }
+
+        ParticleSystem* particles = &game->particles;
+        particles->num_particles = num_particles;
+        particles->num_moved = 0;
+        particles->rng = snapshot->particle_rng;
+        memcpy(particles->x, snapshot->particle_x, num_particles * sizeof(float));
+        memcpy(particles->y, snapshot->particle_y, num_particles * sizeof(float));
+        memcpy(particles->vx, snapshot->particle_vx, num_particles * sizeof(float));
+        memcpy(particles->vy, snapshot->particle_vy, num_particles * sizeof(float));
+        memcpy(particles->life, snapshot->particle_life, num_particles * sizeof(float));
+}
+
+// Replaces the state of game with snapshot. An incomplete snapshot is
+// refused and leaves game untouched.
+bool game_restore(Game* game, const GameSnapshot* snapshot)
+{
+        if(snapshot->num_bullets > GAME_SNAPSHOT_BULLETS || snapshot->num_particles > GAME_SNAPSHOT_PARTICLES)
+        {
+                return false;
+        }
+        game_restore_stored(game, snapshot);
+        return true;
+}
+
+void state_write(uint8_t** cursor, const void* data, size_t size)
+{
+        memcpy(*cursor, data, size);
+        *cursor += size;
+}
+
+void state_read(const uint8_t** cursor, void* data, size_t size)
+{
+        memcpy(data, *cursor, size);
+        *cursor += size;
+}
+
+// Bullets and particles that do not fit a snapshot
+size_t game_overflow_bullets(size_t num_bullets)
+{
+        return num_bullets > GAME_SNAPSHOT_BULLETS? num_bullets - GAME_SNAPSHOT_BULLETS: 0;
+}
+
+size_t game_overflow_particles(size_t num_particles)
+{
+        return num_particles > GAME_SNAPSHOT_PARTICLES? num_particles - GAME_SNAPSHOT_PARTICLES: 0;
+}
+
+size_t game_state_size(const Game* game)
+{
+        return sizeof(GameSnapshot) +
+               game_overflow_bullets(game->bullets.num_bullets) * 3 * sizeof(int16_t) +
+               game_overflow_particles(game->particles.num_particles) * 5 * sizeof(float);
+}
+
+// Writes game_state_size(game) bytes to data: a snapshot, then x, y and
+// dir of every bullet past it and the x, y, vx, vy and life arrays of the
+// particles past it
+void game_save_state(const Game* game, uint8_t* data)
+{
+        uint8_t* cursor = data;
+        GameSnapshot snapshot;
+        game_snapshot(game, &snapshot);
+        state_write(&cursor, &snapshot, sizeof(GameSnapshot));
+
+        const BulletPool& bullets = game->bullets;
+        for(size_t i = GAME_SNAPSHOT_BULLETS; i < bullets.num_bullets; ++i)
+        {
+                const BulletChunk* chunk = bullets.chunks[i / BULLET_CHUNK_SIZE];
+                size_t offset = i % BULLET_CHUNK_SIZE;
+                int16_t bullet[3] = {chunk->x[offset], chunk->y[offset], chunk->dir[offset]};
+                state_write(&cursor, bullet, sizeof(bullet));
+        }
+
+        const ParticleSystem& particles = game->particles;
+        size_t num_overflow = game_overflow_particles(particles.num_particles);
+        state_write(&cursor, particles.x + GAME_SNAPSHOT_PARTICLES, num_overflow * sizeof(float));
+        state_write(&cursor, particles.y + GAME_SNAPSHOT_PARTICLES, num_overflow * sizeof(float));
+        state_write(&cursor, particles.vx + GAME_SNAPSHOT_PARTICLES, num_overflow * sizeof(float));
+        state_write(&cursor, particles.vy + GAME_SNAPSHOT_PARTICLES, num_overflow * sizeof(float));
+        state_write(&cursor, particles.life + GAME_SNAPSHOT_PARTICLES, num_overflow * sizeof(float));
+}
+
+// Whether state can be restored into game: every count within its array
+// and every index within its table
+bool game_state_valid(const Game* game, const GameState* state)
+{
+        // The formation counts index aliens by cell, so there is exactly one
+        // alien per cell and the padding past them stays dead
+        if(state->num_aliens != FORMATION_COLS * FORMATION_ROWS) return false;
+        for(size_t ai = 0; ai < GAME_MAX_ALIENS; ++ai)
+        {
+                if(state->aliens.type[ai] > ALIEN_TYPE_C) return false;
+                if(ai >= state->num_aliens && state->aliens.type[ai] != ALIEN_DEAD) return false;
+        }
+
+        for(size_t i = 0; i < 3; ++i)
+        {
+                const SpriteAnimation& animation = game->alien_animation[i];
+                if(state->animation_time[i] >= animation.num_frames * animation.frame_duration) return false;
+        }
+
+        size_t max_player_x = game->width - player_sprite.width;
+        return state->player.x <= max_player_x && state->player.prev_x <= max_player_x;
+}
+
+// Whether the particle at (x, y) is inside the buffer. Particles are
+// drawn before the next update culls them, so loaded ones have to be.
+bool game_particle_valid(const Game* game, float x, float y)
+{
+        return x >= 0.0f && x < game->particles.width && y >= 0.0f && y < game->particles.height;
+}
+
+// Replaces the state of game with a blob of size bytes written by
+// game_save_state. Blobs come from files, so they are checked first;
+// returns false and leaves game untouched if the blob is malformed.
+bool game_load_state(Game* game, const uint8_t* data, size_t size)
+{
+        if(size < sizeof(GameSnapshot)) return false;
+
+        const uint8_t* cursor = data;
+        GameSnapshot snapshot;
+        state_read(&cursor, &snapshot, sizeof(GameSnapshot));
+
+        size_t num_bullets = snapshot.num_bullets;
+        size_t num_particles = snapshot.num_particles;
+        size_t overflow_bullets = game_overflow_bullets(num_bullets);
+        size_t overflow_particles = game_overflow_particles(num_particles);
+        bool valid = game_state_valid(game, &snapshot.state) &&
+                     num_particles <= game->particles.capacity &&
+                     size - sizeof(GameSnapshot) == overflow_bullets * 3 * sizeof(int16_t) + overflow_particles * 5 * sizeof(float);
+
+        size_t stored_particles = num_particles - overflow_particles;
+        for(size_t i = 0; valid && i < stored_particles; ++i)
+        {
+                valid = game_particle_valid(game, snapshot.particle_x[i], snapshot.particle_y[i]);
+        }
+
+        const uint8_t* particle_data = cursor + overflow_bullets * 3 * sizeof(int16_t);
+        for(size_t i = 0; valid && i < overflow_particles; ++i)
+        {
+                float x, y;
+                memcpy(&x, particle_data + i * sizeof(float), sizeof(float));
+                memcpy(&y, particle_data + (overflow_particles + i) * sizeof(float), sizeof(float));
+                valid = game_particle_valid(game, x, y);
+        }
+
+        if(!valid) return false;
+        game_restore_stored(game, &snapshot);
+
+        // Bullets past the snapshot are respawned, growing the pool as needed
+        for(size_t i = 0; i < overflow_bullets; ++i)
+        {
+                int16_t bullet[3];
+                state_read(&cursor, bullet, sizeof(bullet));
+                bullet_pool_spawn(&game->bullets, bullet[0], bullet[1], bullet[2]);
+        }
+
+        ParticleSystem* particles = &game->particles;
+        particles->num_particles = num_particles;
+        size_t overflow_bytes = overflow_particles * sizeof(float);
+        state_read(&cursor, particles->x + GAME_SNAPSHOT_PARTICLES, overflow_bytes);
+        state_read(&cursor, particles->y + GAME_SNAPSHOT_PARTICLES, overflow_bytes);
+        state_read(&cursor, particles->vx + GAME_SNAPSHOT_PARTICLES, overflow_bytes);
+        state_read(&cursor, particles->vy + GAME_SNAPSHOT_PARTICLES, overflow_bytes);
+        state_read(&cursor, particles->life + GAME_SNAPSHOT_PARTICLES, overflow_bytes);
+        return true;
+}
+
+void game_clock_init(GameClock* clock, double ticks_per_second, size_t max_catchup_ticks)
+{
+        clock->tick_seconds = 1.0 / ticks_per_second;
+        clock->max_catchup_ticks = max_catchup_ticks;
+        clock->accumulator = 0;
+        clock->ticks = 0;
+        clock->dropped_ticks = 0;
+}
+
+// Adds the wall time since the last frame, returns the number of ticks to
+// simulate before drawing the next frame
+size_t game_clock_advance(GameClock* clock, double elapsed_seconds)
+{
+        clock->accumulator += elapsed_seconds;
+        size_t num_ticks = (size_t)(clock->accumulator / clock->tick_seconds);
+        clock->accumulator -= num_ticks * clock->tick_seconds;
+
+        if(num_ticks > clock->max_catchup_ticks)
+        {
+                clock->dropped_ticks += num_ticks - clock->max_catchup_ticks;
+                num_ticks = clock->max_catchup_ticks;
+        }
+
+        clock->ticks += num_ticks;
+        return num_ticks;
+}
+
+// How far the next frame lies between the last tick and the next, in
+// [0, 1]. The accumulator stays below a tick, but the quotient can round
+// up to 1.
+float game_clock_alpha(const GameClock* clock)
+{
+        float alpha = (float)(clock->accumulator / clock->tick_seconds);
+        return alpha < 1.0f? alpha: 1.0f;
+}
@@ -0,0 +1,352 @@
+#ifndef SPACE_INVADERS_GAME_H
+#define SPACE_INVADERS_GAME_H
+
+// Game simulation: aliens, bullets, player, scoring and debris, and the
+// recording of a frame into a DrawList. Window and GL free, shared by
+// every front end.
+
+#include "raster.h"
+
+#include <type_traits>
+
+// Aliens, stored as parallel arrays so passes over all of them stream
+// through six bytes per alien. Entries past num_aliens are padding with
+// type ALIEN_DEAD, so SIMD passes can always run whole vectors.
+#define GAME_MAX_ALIENS 64
+struct Aliens
+{
+        uint16_t x[GAME_MAX_ALIENS];
+        uint16_t y[GAME_MAX_ALIENS];
+        uint8_t type[GAME_MAX_ALIENS];
+        // Frames a dead alien still shows the death sprite for
+        uint8_t death_timer[GAME_MAX_ALIENS];
+};
+
+// Bullets, stored as parallel arrays like the aliens and kept packed in
+// firing order. The arrays are split into chunks of BULLET_CHUNK_SIZE
+// that are allocated as the pool grows and never move; bullet i is entry
+// i % BULLET_CHUNK_SIZE of chunk i / BULLET_CHUNK_SIZE. Coordinates are
+// signed so bullets moving down past the bottom of the buffer are culled
+// like the ones leaving the top.
+//
+// Bullets move within the arrays when others are removed, so they are
+// referred to by handles instead: a slot in the slot table, which holds
+// the current index of the bullet, plus the generation of the slot. The
+// generation is bumped whenever the slot is freed, so a handle to a
+// removed bullet is detected instead of finding a newer bullet.
+#define BULLET_CHUNK_SIZE 1024
+#define BULLET_NO_SLOT 0xFFFFFFFFu
+struct BulletHandle
+{
+        uint32_t slot;
+        uint32_t generation;
+};
+
+struct BulletChunk
+{
+        int16_t x[BULLET_CHUNK_SIZE];
+        int16_t y[BULLET_CHUNK_SIZE];
+        int16_t dir[BULLET_CHUNK_SIZE];
+        uint32_t slot[BULLET_CHUNK_SIZE];
+
+        // Per-tick results: whether the bullet survives, and the alien it hits
+        uint8_t keep[BULLET_CHUNK_SIZE];
+        size_t hit[BULLET_CHUNK_SIZE];
+};
+
+struct BulletPool
+{
+        size_t num_bullets;
+        size_t num_chunks;
+        BulletChunk** chunks;
+
+        // One slot per bullet the chunks can hold. A used slot holds the
+        // index of its bullet, a free slot the next free slot.
+        uint32_t* slot_index;
+        uint32_t* slot_generation;
+        uint32_t free_slot;
+
+        // Bullets before this index moved in the last tick, the ones after
+        // it were spawned since
+        size_t num_moved;
+
+        // Most bullets alive at once in the current tick, and overall
+        size_t frame_peak;
+        size_t peak;
+
+        // Sum of the per-tick peaks over all finished ticks
+        uint64_t frame_peak_total;
+        uint64_t num_ticks;
+};
+
+struct Player
+{
+        size_t x, y;
+        size_t life;
+        // x before the last tick, for drawing between ticks
+        size_t prev_x;
+};
+
+// Uniform grid over the playfield for bullet vs alien tests. Every live
+// alien is listed in each cell its sprite rectangle overlaps, so a bullet
+// is only tested against the aliens of the cells it touches. Cells are
+// stored CSR-style like the draw list bins: the aliens of cell c are
+// cell_aliens[cell_offsets[c] .. cell_offsets[c + 1]], in index order.
+#define COLLISION_CELL_SIZE 16
+#define COLLISION_NO_HIT ((size_t)-1)
+struct CollisionGrid
+{
+        size_t num_cols, num_rows;
+        uint32_t* cell_offsets;
+        size_t capacity;
+        uint32_t* cell_aliens;
+
+        // Counters, accumulated over all queries
+        uint64_t queries;
+        uint64_t candidates;
+};
+
+// Aliens laid out on a regular grid. Alien (col, row) is alien
+// row * num_cols + col, and whatever sprite it shows lies inside the cell
+// rectangle at (origin_x + col * spacing_x, origin_y + row * spacing_y) of
+// size cell_width x cell_height. A position therefore maps straight to
+// the few aliens it can overlap. The live aliens of every column and row
+// are counted as well.
+#define FORMATION_COLS 11
+#define FORMATION_ROWS 5
+struct Formation
+{
+        size_t num_cols, num_rows;
+        size_t origin_x, origin_y;
+        size_t spacing_x, spacing_y;
+        size_t cell_width, cell_height;
+
+        size_t* column_alive;
+        size_t* row_alive;
+
+        // Counters, accumulated over all queries
+        uint64_t queries;
+        uint64_t tests;
+};
+
+// How bullets find the alien they hit
+enum CollisionMode: uint8_t
+{
+        COLLISION_FORMATION = 0,
+        COLLISION_GRID      = 1,
+        COLLISION_SCAN      = 2
+};
+
+// Explosion debris, stored as parallel arrays so the update runs
+// BUFFER_SIMD_LANES particles at a time. Positions are in buffer pixels,
+// velocities in pixels per frame and life in frames. Expired particles and
+// particles that left the buffer are culled by compacting the arrays in
+// the same pass as the update. The arrays are allocated once; spawns past
+// the capacity are dropped.
+#define PARTICLE_GRAVITY 0.04f
+#define PARTICLE_DEATH_BURST 48
+#define PARTICLE_DEFAULT_CAPACITY (1 << 18)
+// Particles per worker pool item when the update runs on several threads
+#define PARTICLE_CHUNK_SIZE 16384
+struct ParticleSystem
+{
+        size_t capacity;
+        size_t num_particles;
+        float* x;
+        float* y;
+        float* vx;
+        float* vy;
+        float* life;
+
+        // Particles outside [0, width) x [0, height) are culled
+        float width, height;
+        uint32_t rng;
+
+        // Particles before this index moved in the last update, the ones
+        // after it were spawned since
+        size_t num_moved;
+
+        // Survivors of every chunk of the last update
+        size_t max_chunks;
+        size_t* chunk_survivors;
+
+        // Counters
+        uint64_t spawned;
+        uint64_t dropped;
+        size_t peak;
+        size_t num_updates;
+        double update_seconds;
+};
+
+// Timing of an animation, its current time is part of the game state
+struct SpriteAnimation
+{
+        bool loop;
+        size_t num_frames;
+        size_t frame_duration;
+        const Sprite* const* frames;
+};
+
+enum AlienType: uint8_t
+{
+        ALIEN_DEAD   = 0,
+        ALIEN_TYPE_A = 1,
+        ALIEN_TYPE_B = 2,
+        ALIEN_TYPE_C = 3
+};
+
+// Every baked sprite table, for backends that upload all sprites up front
+#define NUM_SPRITE_TABLES 10
+struct SpriteTable
+{
+        const uint64_t* rows;
+        size_t num_rows;
+};
+
+extern const SpriteTable sprite_tables[NUM_SPRITE_TABLES];
+
+struct GameConfig
+{
+        size_t width, height;
+        CollisionMode collision_mode;
+
+        // Simulation worker threads in addition to the calling thread,
+        // only used to update large particle counts
+        size_t num_sim_workers;
+
+        // Stress scenarios: keep at least this many particles/bullets alive
+        size_t particle_stress;
+        size_t bullet_stress;
+};
+
+// Fixed-rate simulation clock. Every frame feeds it the elapsed wall time
+// and gets back the number of ticks to simulate; the time left over, as a
+// fraction of a tick, is how far the frame lies between the last tick and
+// the next. At most max_catchup_ticks are simulated per frame, the rest of
+// a longer stall is dropped, so a slow frame makes the game slow down
+// instead of making the next frames slower still.
+#define GAME_TICKS_PER_SECOND 60
+#define GAME_MAX_CATCHUP_TICKS 5
+struct GameClock
+{
+        double tick_seconds;
+        size_t max_catchup_ticks;
+        double accumulator;
+
+        // Counters, accumulated over all frames
+        uint64_t ticks;
+        uint64_t dropped_ticks;
+};
+
+// Player input for one tick
+struct GameInput
+{
+        int move_dir;
+        bool fire;
+};
+
+// The fixed-size part of the game state, kept in one block inside Game
+struct GameState
+{
+        size_t num_aliens;
+        Aliens aliens;
+        Player player;
+
+        size_t score;
+        size_t credits;
+
+        // Current time of every alien animation
+        size_t animation_time[3];
+
+        size_t bullet_stress_column;
+};
+
+// A whole game state in one trivially copyable block, for rollback,
+// search and replay keyframes. Copying a snapshot, to keep several or to
+// send one, is a single memcpy of the block. Taking or restoring one is
+// not: it copies the GameState and the live bullet and particle arrays
+// one by one, and restoring respawns the bullets and rebuilds the derived
+// data. The bullets and particles are stored up to counts normal play
+// stays well below, while the pools grow without a bound. Past those
+// counts a snapshot is incomplete: game_snapshot reports it and
+// game_restore refuses it. Keyframes store the overflow after the block.
+#define GAME_SNAPSHOT_BULLETS 128
+#define GAME_SNAPSHOT_PARTICLES 1024
+struct GameSnapshot
+{
+        GameState state;
+
+        // Live counts, entries past the capacities are not stored
+        uint32_t num_bullets;
+        uint32_t num_particles;
+        uint32_t particle_rng;
+
+        int16_t bullet_x[GAME_SNAPSHOT_BULLETS];
+        int16_t bullet_y[GAME_SNAPSHOT_BULLETS];
+        int16_t bullet_dir[GAME_SNAPSHOT_BULLETS];
+
+        float particle_x[GAME_SNAPSHOT_PARTICLES];
+        float particle_y[GAME_SNAPSHOT_PARTICLES];
+        float particle_vx[GAME_SNAPSHOT_PARTICLES];
+        float particle_vy[GAME_SNAPSHOT_PARTICLES];
+        float particle_life[GAME_SNAPSHOT_PARTICLES];
+};
+
+static_assert(std::is_trivially_copyable<GameSnapshot>::value, "GameSnapshot is copied with memcpy");
+static_assert(GAME_SNAPSHOT_BULLETS <= BULLET_CHUNK_SIZE, "Snapshot bullets come from the first chunk");
+
+struct Game
+{
+        size_t width, height;
+        GameState state;
+        BulletPool bullets;
+
+        // The baked animation of every alien type
+        const SpriteAnimation* alien_animation;
+        // Current sprite of every alien type, indexed by AlienType
+        const Sprite* alien_type_sprites[4];
+
+        CollisionMode collision_mode;
+        Formation formation;
+        CollisionGrid collision_grid;
+
+        ParticleSystem particles;
+        WorkerPool sim_pool;
+        size_t num_sim_workers;
+
+        size_t particle_stress;
+        size_t bullet_stress;
+
+        // HUD strings are only reformatted when their value changes, the
+        // glyphs are rasterized once per distinct string by the run cache
+        TextRunCache* text_runs;
+        char credit_text[16];
+        size_t credit_text_value;
+        char score_text[24];
+        size_t score_text_value;
+};
+
+void game_init(Game* game, const GameConfig& config);
+void game_destroy(Game* game);
+void game_draw(Game* game, DrawList* list, float alpha);
+void game_update(Game* game, const GameInput& input);
+void game_print_stats(const Game* game);
+uint64_t game_state_hash(const Game* game);
+bool game_snapshot(const Game* game, GameSnapshot* snapshot);
+bool game_restore(Game* game, const GameSnapshot* snapshot);
+size_t game_state_size(const Game* game);
+void game_save_state(const Game* game, uint8_t* data);
+bool game_load_state(Game* game, const uint8_t* data, size_t size);
+
+void game_clock_init(GameClock* clock, double ticks_per_second, size_t max_catchup_ticks);
+size_t game_clock_advance(GameClock* clock, double elapsed_seconds);
+float game_clock_alpha(const GameClock* clock);
+
+void bullet_pool_init(BulletPool* pool, size_t capacity);
+void bullet_pool_destroy(BulletPool* pool);
+size_t bullet_pool_chunk_size(const BulletPool* pool, size_t c);
+BulletHandle bullet_pool_spawn(BulletPool* pool, int x, int y, int dir);
+bool bullet_pool_lookup(const BulletPool* pool, BulletHandle handle, size_t* index);
+void bullet_pool_clear(BulletPool* pool);
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "replay.h"
+
+// Runs the game without a window or GL context: a scripted or recorded
+// player, the software rasterizer and no presentation. For benchmarks,
+// replays and batch runs on hosts without a display.
+
+// Writes buffer as a binary PPM, top row first
+bool buffer_write_ppm(const Buffer* buffer, const char* path)
+{
+        FILE* file = fopen(path, "wb");
+        if(!file) return false;
+
+        fprintf(file, "P6 %zu %zu 255\n", buffer->width, buffer->height);
+        for(size_t yi = buffer->height; yi-- > 0;)
+        {
+                for(size_t xi = 0; xi < buffer->width; ++xi)
+                {
+                        uint32_t pixel = buffer->data[yi * buffer->width + xi];
+                        uint8_t rgb[3] = {
+                                (uint8_t)(pixel >> pixel_format.r_shift),
+                                (uint8_t)(pixel >> pixel_format.g_shift),
+                                (uint8_t)(pixel >> pixel_format.b_shift)
+                        };
+                        fwrite(rgb, 1, 3, file);
+                }
+        }
+
+        fclose(file);
+        return true;
+}
+
+int main(int argc, char* argv[])
+{
+        const size_t buffer_width = 224;
+        const size_t buffer_height = 256;
+
+        GameConfig game_config;
+        game_config.width = buffer_width;
+        game_config.height = buffer_height;
+        game_config.collision_mode = COLLISION_FORMATION;
+        game_config.num_sim_workers = 0;
+        game_config.particle_stress = 0;
+        game_config.bullet_stress = 0;
+
+        size_t num_ticks = 600;
+
+        // Scripted input: fire on every fire_period-th tick, and hold right
+        // for the first move_ticks ticks
+        size_t fire_period = 0;
+        size_t move_ticks = 0;
+
+        // Skip rasterizing, to measure the simulation alone
+        bool rasterize = true;
+        const char* dump_path = 0;
+
+        // Replay a recorded session instead of the scripted input, and/or
+        // record the input that was played
+        const char* replay_path = 0;
+        const char* record_path = 0;
+        size_t keyframe_interval = REPLAY_DEFAULT_KEYFRAME_INTERVAL;
+
+        // Start the replay at this tick, from the keyframe before it
+        size_t seek_tick = 0;
+
+        size_t num_raster_workers = std::thread::hardware_concurrency();
+        num_raster_workers = num_raster_workers > 1? num_raster_workers - 1: 0;
+        if(num_raster_workers > 7) num_raster_workers = 7;
+
+        for(int i = 1; i < argc; ++i)
+        {
+                if(strcmp(argv[i], "--bench-clear") == 0)
+                {
+                        buffer_clear_benchmark();
+                        return 0;
+                }
+                else if(strcmp(argv[i], "--ticks") == 0 && i + 1 < argc)
+                {
+                        num_ticks = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--fire-period") == 0 && i + 1 < argc)
+                {
+                        fire_period = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--move-ticks") == 0 && i + 1 < argc)
+                {
+                        move_ticks = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--no-raster") == 0)
+                {
+                        rasterize = false;
+                }
+                else if(strcmp(argv[i], "--dump") == 0 && i + 1 < argc)
+                {
+                        // Last frame as a PPM image
+                        dump_path = argv[++i];
+                }
+                else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+                {
+                        replay_path = argv[++i];
+                }
+                else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+                {
+                        record_path = argv[++i];
+                }
+                else if(strcmp(argv[i], "--keyframe-interval") == 0 && i + 1 < argc)
+                {
+                        keyframe_interval = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--seek") == 0 && i + 1 < argc)
+                {
+                        seek_tick = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--raster-threads") == 0 && i + 1 < argc)
+                {
+                        int num_threads = atoi(argv[++i]);
+                        num_raster_workers = num_threads > 1? num_threads - 1: 0;
+                }
+                else if(strcmp(argv[i], "--sim-threads") == 0 && i + 1 < argc)
+                {
+                        int num_threads = atoi(argv[++i]);
+                        game_config.num_sim_workers = num_threads > 1? num_threads - 1: 0;
+                }
+                else if(strcmp(argv[i], "--collision") == 0 && i + 1 < argc)
+                {
+                        const char* name = argv[++i];
+                        if(strcmp(name, "formation") == 0) game_config.collision_mode = COLLISION_FORMATION;
+                        else if(strcmp(name, "grid") == 0) game_config.collision_mode = COLLISION_GRID;
+                        else if(strcmp(name, "scan") == 0) game_config.collision_mode = COLLISION_SCAN;
+                        else fprintf(stderr, "Unknown collision mode %s, using formation\n", name);
+                }
+                else if(strcmp(argv[i], "--bullet-stress") == 0 && i + 1 < argc)
+                {
+                        game_config.bullet_stress = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--particle-stress") == 0 && i + 1 < argc)
+                {
+                        game_config.particle_stress = strtoul(argv[++i], 0, 10);
+                }
+                else
+                {
+                        fprintf(stderr, "Unknown argument %s\n", argv[i]);
+                        return 1;
+                }
+        }
+
+        // A replay runs the whole log with the config it was recorded with
+        if(seek_tick > 0 && (!replay_path || record_path))
+        {
+                fprintf(stderr, "--seek needs --replay and can't be recorded\n");
+                return 1;
+        }
+
+        InputLog replay;
+        input_log_init(&replay, game_config, 0);
+        if(replay_path)
+        {
+                if(!input_log_read(&replay, replay_path))
+                {
+                        fprintf(stderr, "Could not read replay %s\n", replay_path);
+                        input_log_destroy(&replay);
+                        return 1;
+                }
+                input_log_apply_config(&replay, &game_config);
+                num_ticks = replay.num_ticks;
+                if(seek_tick > num_ticks) seek_tick = num_ticks;
+        }
+
+        if(game_config.width != buffer_width || game_config.height != buffer_height)
+        {
+                fprintf(stderr, "Replay is for a %zux%zu buffer, not %zux%zu\n",
+                        game_config.width, game_config.height, buffer_width, buffer_height);
+                input_log_destroy(&replay);
+                return 1;
+        }
+
+        InputLog record;
+        input_log_init(&record, game_config, keyframe_interval);
+
+        Game* game = new Game;
+        game_init(game, game_config);
+
+        if(seek_tick > 0)
+        {
+                auto seek_start = std::chrono::steady_clock::now();
+                size_t num_simulated = 0;
+                if(!input_log_seek(&replay, game, seek_tick, &num_simulated))
+                {
+                        fprintf(stderr, "Replay %s has a malformed keyframe before tick %zu\n", replay_path, seek_tick);
+                        game_destroy(game);
+                        delete game;
+                        input_log_destroy(&replay);
+                        input_log_destroy(&record);
+                        return 1;
+                }
+                double seek_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - seek_start).count();
+                printf("Seek to tick %zu: %zu ticks simulated after the keyframe, %.3f ms\n",
+                       seek_tick, num_simulated, 1000.0 * seek_seconds);
+        }
+        size_t num_run_ticks = num_ticks - seek_tick;
+
+        Buffer buffer;
+        buffer.width = buffer_width;
+        buffer.height = buffer_height;
+        buffer.data = new uint32_t[buffer.width * buffer.height];
+        uint32_t clear_color = rgb_to_uint32(0, 128, 0);
+
+        DirtyTracker* tracker = new DirtyTracker;
+        dirty_tracker_init(tracker, buffer.width, buffer.height);
+        DrawList list;
+        draw_list_init(&list, 256, buffer.height);
+
+        WorkerPool raster_pool;
+        worker_pool_init(&raster_pool, rasterize? num_raster_workers: 0);
+
+        double draw_seconds = 0;
+        double raster_seconds = 0;
+        double update_seconds = 0;
+        auto run_start = std::chrono::steady_clock::now();
+
+        for(size_t tick = seek_tick; tick < num_ticks; ++tick)
+        {
+                auto draw_start = std::chrono::steady_clock::now();
+                DrawList* frame_list = &list;
+                if(rasterize) frame_list = dirty_tracker_begin_frame(tracker);
+                else draw_list_reset(&list);
+                game_draw(game, frame_list, 1.0f);
+
+                auto raster_start = std::chrono::steady_clock::now();
+                if(rasterize) dirty_tracker_end_frame(tracker, &buffer, clear_color, &raster_pool);
+                if(dump_path && tick + 1 == num_ticks)
+                {
+                        if(!rasterize) fprintf(stderr, "--dump needs the rasterizer, nothing written\n");
+                        else if(!buffer_write_ppm(&buffer, dump_path)) fprintf(stderr, "Could not write %s\n", dump_path);
+                }
+
+                auto update_start = std::chrono::steady_clock::now();
+                GameInput input;
+                if(replay_path)
+                {
+                        input = input_log_input(&replay, tick);
+                }
+                else
+                {
+                        input.move_dir = tick < move_ticks? 1: 0;
+                        input.fire = fire_period > 0 && tick > 0 && tick % fire_period == 0;
+                }
+                if(record_path) input_log_record(&record, game, input);
+                game_update(game, input);
+                auto update_end = std::chrono::steady_clock::now();
+
+                draw_seconds += std::chrono::duration<double>(raster_start - draw_start).count();
+                raster_seconds += std::chrono::duration<double>(update_start - raster_start).count();
+                update_seconds += std::chrono::duration<double>(update_end - update_start).count();
+        }
+
+        double run_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+        if(num_run_ticks > 0 && run_seconds > 0)
+        {
+                printf("Ticks: %zu in %.2f s, %.1f per second\n", num_run_ticks, run_seconds, num_run_ticks / run_seconds);
+                printf("Per tick: %.3f ms draw, %.3f ms raster on %zu threads, %.3f ms update\n",
+                       1000.0 * draw_seconds / num_run_ticks, 1000.0 * raster_seconds / num_run_ticks,
+                       rasterize? num_raster_workers + 1: 0, 1000.0 * update_seconds / num_run_ticks);
+        }
+        printf("Score: %zu\n", game->state.score);
+        printf("State hash: %016llx\n", (unsigned long long)game_state_hash(game));
+        game_print_stats(game);
+
+        if(record_path && !input_log_write(&record, record_path))
+        {
+                fprintf(stderr, "Could not write %s\n", record_path);
+        }
+        input_log_destroy(&record);
+        input_log_destroy(&replay);
+
+        worker_pool_destroy(&raster_pool);
+        draw_list_destroy(&list);
+        dirty_tracker_destroy(tracker);
+        delete tracker;
+        delete[] buffer.data;
+
+        game_destroy(game);
+        delete game;
+
+        return 0;
+}
@@ -1,7 +1,14 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <thread>
+
+#include "replay.h"
 
 bool game_running = false;
 int move_dir = 0;
@@ -57,6 +64,222 @@ bool validate_program(GLuint program){
         return true;
 }
 
+// GL_ARB_buffer_storage (core in 4.4) is not in the generated loader
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT   0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Ring of pixel unpack buffers used to stream the framebuffer to the
+// texture. Each frame is copied into the next buffer of the ring and
+// uploaded from there, so glTexSubImage2D returns without waiting for the
+// copy and the GPU transfers frame N while frame N+1 is being drawn. A
+// fence per buffer keeps the CPU from overwriting a buffer the GPU is
+// still reading. Buffers are persistently mapped when buffer storage is
+// available, otherwise they are mapped unsynchronized every frame.
+#define PBO_RING_SIZE 3
+struct PboRing
+{
+        GLuint buffers[PBO_RING_SIZE];
+        GLsync fences[PBO_RING_SIZE];
+        void* mapped[PBO_RING_SIZE];
+        size_t size;
+        size_t current;
+        bool persistent;
+        uint64_t stalls;
+};
+
+void pbo_ring_init(PboRing* ring, size_t size)
+{
+        ring->size = size;
+        ring->current = 0;
+        ring->stalls = 0;
+
+        PFNGLBUFFERSTORAGEPROC buffer_storage = 0;
+        if(glfwExtensionSupported("GL_ARB_buffer_storage"))
+        {
+                buffer_storage = (PFNGLBUFFERSTORAGEPROC)glfwGetProcAddress("glBufferStorage");
+        }
+        ring->persistent = buffer_storage != 0;
+
+        glGenBuffers(PBO_RING_SIZE, ring->buffers);
+        for(size_t i = 0; i < PBO_RING_SIZE; ++i)
+        {
+                ring->fences[i] = 0;
+                ring->mapped[i] = 0;
+
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->buffers[i]);
+                if(ring->persistent)
+                {
+                        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                        buffer_storage(GL_PIXEL_UNPACK_BUFFER, size, 0, flags);
+                        ring->mapped[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+                }
+                else
+                {
+                        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+                }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void pbo_ring_destroy(PboRing* ring)
+{
+        for(size_t i = 0; i < PBO_RING_SIZE; ++i)
+        {
+                if(ring->fences[i]) glDeleteSync(ring->fences[i]);
+                if(ring->mapped[i])
+                {
+                        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->buffers[i]);
+                        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(PBO_RING_SIZE, ring->buffers);
+}
+
+// Waits until the GPU is done with the next buffer, binds it to
+// GL_PIXEL_UNPACK_BUFFER and returns a pointer to write the frame to.
+uint8_t* pbo_ring_map(PboRing* ring)
+{
+        size_t i = ring->current;
+        if(ring->fences[i])
+        {
+                GLenum status = glClientWaitSync(ring->fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+                if(status == GL_TIMEOUT_EXPIRED)
+                {
+                        ++ring->stalls;
+                        glClientWaitSync(ring->fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                }
+                glDeleteSync(ring->fences[i]);
+                ring->fences[i] = 0;
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->buffers[i]);
+        if(ring->persistent) return (uint8_t*)ring->mapped[i];
+
+        // The fence already guarantees the GPU is done with this buffer
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        return (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ring->size, flags);
+}
+
+// Call after writing the frame and before uploading from the buffer
+void pbo_ring_unmap(PboRing* ring)
+{
+        if(!ring->persistent) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+}
+
+// Call after the uploads from the buffer have been issued
+void pbo_ring_fence(PboRing* ring)
+{
+        ring->fences[ring->current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        ring->current = (ring->current + 1) % PBO_RING_SIZE;
+}
+
+// Ways of uploading the framebuffer to the texture. Drivers convert some
+// of these on the CPU, so the fastest one is picked at startup and the
+// pixel packing used by rgb_to_uint32 follows it. The shifts give the bit
+// position of each channel in a uint32_t pixel; for the byte formats they
+// assume a little-endian host.
+struct UploadFormat
+{
+        const char* name;
+        GLenum internal_format;
+        GLenum format;
+        GLenum type;
+        PixelFormat pixel_format;
+};
+
+static const UploadFormat upload_formats[] =
+{
+        {"rgb8_rgba_8888",     GL_RGB8,  GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,     {24, 16,  8,  0}},
+        {"rgba8_rgba_8888",    GL_RGBA8, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,     {24, 16,  8,  0}},
+        {"rgba8_rgba_ubyte",   GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE,             { 0,  8, 16, 24}},
+        {"rgba8_bgra_8888rev", GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, {16,  8,  0, 24}},
+        {"rgba8_bgra_ubyte",   GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE,            {16,  8,  0, 24}}
+};
+#define NUM_UPLOAD_FORMATS (sizeof(upload_formats) / sizeof(upload_formats[0]))
+
+static const UploadFormat* upload_format = &upload_formats[0];
+
+const UploadFormat* upload_format_find(const char* name)
+{
+        for(size_t i = 0; i < NUM_UPLOAD_FORMATS; ++i)
+        {
+                if(strcmp(upload_formats[i].name, name) == 0) return &upload_formats[i];
+        }
+
+        return 0;
+}
+
+bool host_is_little_endian()
+{
+        const uint32_t one = 1;
+        return *(const uint8_t*)&one == 1;
+}
+
+// Times full-frame uploads of width x height pixels for every format and
+// returns the fastest one. Formats the driver rejects are skipped.
+const UploadFormat* upload_format_autotune(size_t width, size_t height)
+{
+        const size_t warmup = 2;
+        const size_t iterations = 16;
+
+        uint32_t* pixels = new uint32_t[width * height];
+        for(size_t i = 0; i < width * height; ++i)
+        {
+                pixels[i] = (uint32_t)i * 2654435761u;
+        }
+
+        const UploadFormat* best = &upload_formats[0];
+        double best_time = 0;
+
+        GLuint texture;
+        for(size_t fi = 0; fi < NUM_UPLOAD_FORMATS; ++fi)
+        {
+                const UploadFormat& format = upload_formats[fi];
+                if(format.type == GL_UNSIGNED_BYTE && !host_is_little_endian()) continue;
+
+                while(glGetError() != GL_NO_ERROR) {}
+
+                glGenTextures(1, &texture);
+                glBindTexture(GL_TEXTURE_2D, texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, width, height, 0, format.format, format.type, 0);
+
+                double time = 0;
+                for(size_t i = 0; i < warmup + iterations; ++i)
+                {
+                        auto start = std::chrono::steady_clock::now();
+                        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format.format, format.type, pixels);
+                        glFinish();
+                        auto end = std::chrono::steady_clock::now();
+                        if(i >= warmup) time += std::chrono::duration<double, std::micro>(end - start).count();
+                }
+                time /= iterations;
+
+                glDeleteTextures(1, &texture);
+                if(glGetError() != GL_NO_ERROR)
+                {
+                        printf("Upload format %-20s unsupported\n", format.name);
+                        continue;
+                }
+
+                printf("Upload format %-20s %8.1f us\n", format.name, time);
+                if(best_time == 0 || time < best_time)
+                {
+                        best = &format;
+                        best_time = time;
+                }
+        }
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        delete[] pixels;
+
+        return best;
+}
+
 void error_callback(int error, const char* description)
 {
         fprintf(stderr, "Error: %s\n", description);
@@ -84,250 +307,269 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         }
 }
 
-struct Buffer
+// Foreground color of the rows [y_begin, y_end) when a BitBuffer is
+// displayed. The overlay texture has one texel per OVERLAY_ROWS_PER_TEXEL rows.
+#define OVERLAY_ROWS_PER_TEXEL 8
+struct OverlayBand
 {
-        size_t width, height;
-        uint32_t* data;
+        size_t y_begin, y_end;
+        uint8_t r, g, b;
 };
 
-struct Sprite
+/* Renderers
+ *
+ * The game records every frame into a DrawList and hands it to one of the
+ * backends below, which present it:
+ *
+ * - cpu:  rasterizes the dirty parts of the frame into a Buffer (or a 1bpp
+ *         BitBuffer) and uploads them to a fullscreen texture
+ * - gpu:  draws every command as an instanced quad that tests the sprite
+ *         bits in the fragment shader
+ * - null: drops the frame, for measuring everything but rendering
+ */
+enum RendererBackend: uint8_t
 {
-        size_t width, height;
-        uint8_t* data;
+        RENDERER_CPU  = 0,
+        RENDERER_GPU  = 1,
+        RENDERER_NULL = 2
 };
 
-struct Alien
+struct RendererConfig
 {
-        size_t x, y;
-        uint8_t type;
+        RendererBackend backend;
+        size_t width, height;
+        uint8_t clear_r, clear_g, clear_b;
+
+        // cpu backend only
+        bool packed_framebuffer;
+        bool use_pbo_ring;
+        const char* upload_format_name;
+        size_t num_raster_workers;
 };
 
-struct Bullet
+struct CpuRenderer
 {
-        size_t x, y;
-        int dir;
+        // Render into a 1 bit per pixel plane that the fragment shader
+        // colorizes, instead of a full RGBA buffer
+        bool packed_framebuffer;
+
+        // Stream the framebuffer through a ring of pixel buffer objects
+        // instead of uploading straight from client memory
+        bool use_pbo_ring;
+
+        Buffer buffer;
+        BitBuffer bit_buffer;
+        size_t bit_buffer_row_bytes;
+        PboRing pbo_ring;
+
+        GLuint buffer_texture;
+        GLuint overlay_texture;
+        GLuint vao;
+        GLuint program;
+
+        // The frame is recorded into a draw list and only the parts that
+        // changed since the last frame are redrawn and uploaded
+        DirtyTracker dirty_tracker;
+        WorkerPool raster_pool;
+
+        uint64_t packed_bytes_uploaded;
 };
 
-struct Player
+// Sprites live in a buffer texture of row masks, two 32-bit texels per
+// 64-bit row. The baked sprite tables are uploaded once at the start of
+// the buffer; sprites that are built at run time, like text runs, are
+// appended after them every frame. Instances are one RGBA32UI texel each:
+// x | y << 16, width | height << 16, first row (or GPU_SOLID_RECT) and color.
+// Commands are drawn as instanced quads, the draw list's points, which
+// follow them in the instance buffer, as one batch of GL_POINTS.
+#define GPU_SOLID_RECT 0xFFFFFFFFu
+struct GpuRenderer
 {
-        size_t x, y;
-        size_t life;
+        GLuint program;
+        GLint first_point_location;
+        GLuint vao;
+        GLuint rows_buffer, rows_texture;
+        GLuint instance_buffer, instance_texture;
+
+        size_t table_offsets[NUM_SPRITE_TABLES];
+        size_t num_static_rows;
+        size_t num_rows, rows_capacity;
+        uint32_t* rows;
+
+        size_t instances_capacity;
+        uint32_t* instances;
+
+        DrawList list;
+        uint64_t instances_drawn;
+        uint64_t dynamic_rows_uploaded;
 };
 
-#define GAME_MAX_BULLETS 128
-struct Game
+struct Renderer
 {
+        RendererBackend backend;
         size_t width, height;
-        size_t num_aliens;
-        size_t num_bullets;
-        Alien* aliens;
-        Player player;
-        Bullet bullets[GAME_MAX_BULLETS];
-};
+        uint32_t clear_color;
 
-struct SpriteAnimation
-{
-        bool loop;
-        size_t num_frames;
-        size_t frame_duration;
-        size_t time;
-        Sprite** frames;
-};
+        CpuRenderer cpu;
+        GpuRenderer gpu;
+        DrawList null_list;
 
-enum AlienType: uint8_t
-{
-        ALIEN_DEAD   = 0,
-        ALIEN_TYPE_A = 1,
-        ALIEN_TYPE_B = 2,
-        ALIEN_TYPE_C = 3
+        // Counters, accumulated over all frames
+        size_t num_frames;
+        double end_frame_seconds;
 };
 
-void buffer_clear(Buffer* buffer, uint32_t color)
-{
-        for(size_t i = 0; i < buffer->width * buffer->height; ++i)
-        {
-                buffer->data[i] = color;
-        }
-}
+static const char* renderer_backend_names[] = {"cpu", "gpu", "null"};
 
-bool sprite_overlap_check(
-        const Sprite& sp_a, size_t x_a, size_t y_a,
-        const Sprite& sp_b, size_t x_b, size_t y_b
-)
+// Compiles and links a program, returns 0 on failure
+GLuint shader_program_create(const char* vertex_source, const char* fragment_source)
 {
-        // NOTE: For simplicity we just check for overlap of the sprite
-        // rectangles. Instead, if the rectangles overlap, we should
-        // further check if any pixel of sprite A overlap with any of
-        // sprite B.
-        if(x_a < x_b + sp_b.width && x_a + sp_a.width > x_b &&
-           y_a < y_b + sp_b.height && y_a + sp_a.height > y_b)
-        {
-                return true;
-        }
+        GLuint program = glCreateProgram();
 
-        return false;
-}
-
-void buffer_draw_sprite(Buffer* buffer, const Sprite& sprite, size_t x, size_t y, uint32_t color)
-{
-        for(size_t xi = 0; xi < sprite.width; ++xi)
         {
-                for(size_t yi = 0; yi < sprite.height; ++yi)
-                {
-                        if(sprite.data[yi * sprite.width + xi] &&
-                           (sprite.height - 1 + y - yi) < buffer->height &&
-                           (x + xi) < buffer->width)
-                        {
-                                buffer->data[(sprite.height - 1 + y - yi)
-                                             * buffer->width
-                                             + (x + xi)] = color;
-                        }
-                }
-        }
-}
+                //Create vertex shader
+                GLuint shader_vp = glCreateShader(GL_VERTEX_SHADER);
 
-void buffer_draw_number(Buffer* buffer, const Sprite& number_spritesheet,
-                        size_t number, size_t x, size_t y, uint32_t color)
-{
-        uint8_t digits[64];
-        size_t num_digits = 0;
+                glShaderSource(shader_vp, 1, &vertex_source, 0);
+                glCompileShader(shader_vp);
+                validate_shader(shader_vp, vertex_source);
+                glAttachShader(program, shader_vp);
 
-        size_t current_number = number;
-        do
-        {
-                digits[num_digits++] = current_number % 10;
-                current_number = current_number / 10;
+                glDeleteShader(shader_vp);
         }
-        while(current_number > 0);
 
-        size_t xp = x;
-        size_t stride = number_spritesheet.width * number_spritesheet.height;
-        Sprite sprite = number_spritesheet;
-        for(size_t i = 0; i < num_digits; ++i)
         {
-                uint8_t digit = digits[num_digits - i - 1];
-                sprite.data = number_spritesheet.data + digit * stride;
-                buffer_draw_sprite(buffer, sprite, xp, y, color);
-                xp += sprite.width + 1;
-        }
-}
+                //Create fragment shader
+                GLuint shader_fp = glCreateShader(GL_FRAGMENT_SHADER);
 
-void buffer_draw_text(Buffer* buffer, const Sprite& text_spritesheet,
-                      const char* text, size_t x, size_t y,
-                      uint32_t color)
-{
-        size_t xp = x;
-        size_t stride = text_spritesheet.width * text_spritesheet.height;
-        Sprite sprite = text_spritesheet;
-        for(const char* charp = text; *charp != '\0'; ++charp)
-        {
-                char character = *charp - 32;
-                if(character < 0 || character >= 65) continue;
+                glShaderSource(shader_fp, 1, &fragment_source, 0);
+                glCompileShader(shader_fp);
+                validate_shader(shader_fp, fragment_source);
+                glAttachShader(program, shader_fp);
 
-                sprite.data = text_spritesheet.data + character * stride;
-                buffer_draw_sprite(buffer, sprite, xp, y, color);
-                xp += sprite.width + 1;
+                glDeleteShader(shader_fp);
         }
-}
 
-uint32_t rgb_to_uint32(uint8_t r, uint8_t g, uint8_t b)
-{
-        return (r << 24) | (g << 16) | (b << 8) | 255;
-}
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-// ---------------------------------------------------------------------------------------------------------
-void processInput(GLFWwindow *window)
-{
-        if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
-                glfwSetWindowShouldClose(window, true);
+        glLinkProgram(program);
+
+        if(!validate_program(program))
+        {
+                fprintf(stderr, "Error while validating shader.\n");
+                glDeleteProgram(program);
+                return 0;
         }
-}
 
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
-// ---------------------------------------------------------------------------------------------
-void framebuffer_size_callback(GLFWwindow* window, int width, int height)
-{
-        // make sure the viewport matches the new window dimensions; note that width and 
-        // height will be significantly larger than specified on retina displays.
-        glViewport(0, 0, width, height);
+        return program;
 }
 
-int main()
+bool cpu_renderer_init(CpuRenderer* renderer, const RendererConfig& config, Renderer* parent)
 {
-        const size_t buffer_width = 224;
-        const size_t buffer_height = 256;
-        
-        glfwSetErrorCallback(error_callback);
+        renderer->packed_framebuffer = config.packed_framebuffer;
+        renderer->use_pbo_ring = config.use_pbo_ring;
+        renderer->packed_bytes_uploaded = 0;
 
-        if (!glfwInit()) return -1;
-        
-        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-
-        GLFWwindow* window = glfwCreateWindow(buffer_width, buffer_height, "Space Invaders", NULL, NULL);
-        if (window == NULL)
+        if(!renderer->packed_framebuffer)
         {
-                std::cout << "Failed to create GLFW window" << std::endl;
-                glfwTerminate();
-                return -1;
-        }
-
-        glfwSetKeyCallback(window, key_callback);
-
-        glfwMakeContextCurrent(window);
-
-        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+                const UploadFormat* format = config.upload_format_name? upload_format_find(config.upload_format_name): 0;
+                if(config.upload_format_name && !format)
+                {
+                        fprintf(stderr, "Unknown upload format %s, autotuning instead\n", config.upload_format_name);
+                }
 
-        // glad: load all OpenGL function pointers
-        // ---------------------------------------
-        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
-        {
-                std::cout << "Failed to initialize GLAD" << std::endl;
-                glfwTerminate();
-                return -1;
+                upload_format = format? format: upload_format_autotune(config.width, config.height);
+                pixel_format = upload_format->pixel_format;
+                printf("Upload format: %s (%s)\n", upload_format->name, format? "pinned": "autotuned");
         }
-        int glVersion[2] = {-1,1};
-        glGetIntegerv(GL_MAJOR_VERSION, &glVersion[0]);
-        glGetIntegerv(GL_MINOR_VERSION, &glVersion[1]);
-
-        gl_debug(__FILE__, __LINE__);
-
-        printf("Using OpenGL: %d.%d\n", glVersion[0], glVersion[1]);
-        printf("Renderer used: %s\n", glGetString(GL_RENDERER));
-        printf("Shading Language: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
-
-        glfwSwapInterval(1);
-
-        // args: red, green, blue, alpha
-        glClearColor(1.0, 0.0, 0.0, 1.0);
+        parent->clear_color = rgb_to_uint32(config.clear_r, config.clear_g, config.clear_b);
 
         // Create graphics buffer
-        Buffer buffer;
-        buffer.width  = buffer_width;
-        buffer.height = buffer_height;
+        Buffer& buffer = renderer->buffer;
+        buffer.width  = config.width;
+        buffer.height = config.height;
         buffer.data   = new uint32_t[buffer.width * buffer.height];
 
         buffer_clear(&buffer, 0);
 
+        BitBuffer& bit_buffer = renderer->bit_buffer;
+        bit_buffer_init(&bit_buffer, buffer.width, buffer.height);
+        bit_buffer_clear(&bit_buffer);
+        renderer->bit_buffer_row_bytes = bit_buffer.words_per_row * sizeof(uint64_t);
+
         // Create texture for presenting buffer to OpenGL
-        GLuint buffer_texture;
         /** buffer_texture will store the names/ints of the generated
          *  textures in opengl
          */
-        glGenTextures(1, &buffer_texture);
+        glGenTextures(1, &renderer->buffer_texture);
         /* The generated number is then associated with a 2d texture */
-        glBindTexture(GL_TEXTURE_2D, buffer_texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, buffer.width, buffer.height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, buffer.data);
+        glBindTexture(GL_TEXTURE_2D, renderer->buffer_texture);
+        if(renderer->packed_framebuffer)
+        {
+                /* One byte holds 8 pixels, the shader unpacks them */
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, renderer->bit_buffer_row_bytes, bit_buffer.height, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, bit_buffer.data);
+        }
+        else
+        {
+                glTexImage2D(GL_TEXTURE_2D, 0, upload_format->internal_format, buffer.width, buffer.height, 0,
+                             upload_format->format, upload_format->type, buffer.data);
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, buffer.width);
+        }
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+        // Foreground colors of the 1bpp plane by screen row, like the
+        // cellophane overlay of the arcade cabinet. Bands are given
+        // bottom to top.
+        const OverlayBand overlay_bands[] =
+        {
+                {0, buffer.height, 128, 0, 0}
+        };
+
+        renderer->overlay_texture = 0;
+        if(renderer->packed_framebuffer)
+        {
+                size_t overlay_height = (buffer.height + OVERLAY_ROWS_PER_TEXEL - 1) / OVERLAY_ROWS_PER_TEXEL;
+                uint8_t* overlay = new uint8_t[4 * overlay_height];
+                for(size_t i = 0; i < overlay_height; ++i)
+                {
+                        size_t y = i * OVERLAY_ROWS_PER_TEXEL;
+                        for(size_t bi = 0; bi < sizeof(overlay_bands) / sizeof(overlay_bands[0]); ++bi)
+                        {
+                                const OverlayBand& band = overlay_bands[bi];
+                                if(y < band.y_begin || y >= band.y_end) continue;
+                                overlay[4 * i + 0] = band.r;
+                                overlay[4 * i + 1] = band.g;
+                                overlay[4 * i + 2] = band.b;
+                                overlay[4 * i + 3] = 255;
+                        }
+                }
+
+                glGenTextures(1, &renderer->overlay_texture);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, renderer->overlay_texture);
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, overlay_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, overlay);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                glActiveTexture(GL_TEXTURE0);
+
+                delete[] overlay;
+        }
+
+        if(renderer->use_pbo_ring)
+        {
+                size_t frame_bytes = renderer->packed_framebuffer?
+                                     renderer->bit_buffer_row_bytes * bit_buffer.height:
+                                     buffer.width * buffer.height * sizeof(uint32_t);
+                pbo_ring_init(&renderer->pbo_ring, frame_bytes);
+                printf("Streaming uploads through %d %s pixel buffers\n", PBO_RING_SIZE,
+                       renderer->pbo_ring.persistent? "persistently mapped": "mapped");
+        }
+
         // Create vao for generating fullscreen triangle
-        GLuint fullscreen_triangle_vao;
-        glGenVertexArrays(1, &fullscreen_triangle_vao);
+        glGenVertexArrays(1, &renderer->vao);
 
         // Create shader for displaying buffer
         static const char* vertex_shader =
@@ -357,483 +599,807 @@ int main()
                 "    outColor = texture(buffer, TexCoord).rgb;\n"
                 "}\n";
 
-        GLuint shader_id = glCreateProgram();
-
-        {
-                //Create vertex shader
-                GLuint shader_vp = glCreateShader(GL_VERTEX_SHADER);
-
-                glShaderSource(shader_vp, 1, &vertex_shader, 0);
-                glCompileShader(shader_vp);
-                validate_shader(shader_vp, vertex_shader);
-                glAttachShader(shader_id, shader_vp);
-
-                glDeleteShader(shader_vp);
-        }
-
-        {
-                //Create fragment shader
-                GLuint shader_fp = glCreateShader(GL_FRAGMENT_SHADER);
-
-                glShaderSource(shader_fp, 1, &fragment_shader, 0);
-                glCompileShader(shader_fp);
-                validate_shader(shader_fp, fragment_shader);
-                glAttachShader(shader_id, shader_fp);
+        static const char* fragment_shader_1bpp =
+                "\n"
+                "#version 330\n"
+                "\n"
+                "uniform usampler2D buffer;\n"
+                "uniform sampler2D overlay;\n"
+                "uniform ivec2 buffer_size;\n"
+                "uniform vec3 background;\n"
+                "noperspective in vec2 TexCoord;\n"
+                "\n"
+                "out vec3 outColor;\n"
+                "\n"
+                "void main(void){\n"
+                "    ivec2 pixel = min(ivec2(TexCoord * vec2(buffer_size)), buffer_size - 1);\n"
+                "    uint bits = texelFetch(buffer, ivec2(pixel.x >> 3, pixel.y), 0).r;\n"
+                "    bool set = ((bits >> uint(pixel.x & 7)) & 1u) != 0u;\n"
+                "    outColor = set? texture(overlay, vec2(0.5, TexCoord.y)).rgb: background;\n"
+                "}\n";
 
-                glDeleteShader(shader_fp);
-        }
+        renderer->program = shader_program_create(vertex_shader, renderer->packed_framebuffer?
+                                                                 fragment_shader_1bpp: fragment_shader);
 
-        glLinkProgram(shader_id);
+        // The raster pool and tracker are set up before bailing out, so
+        // cpu_renderer_destroy can always release everything
+        dirty_tracker_init(&renderer->dirty_tracker, buffer.width, buffer.height);
+        worker_pool_init(&renderer->raster_pool, config.num_raster_workers);
+        printf("Rasterizer threads: %zu\n", config.num_raster_workers + 1);
 
-        if(!validate_program(shader_id)){
-                fprintf(stderr, "Error while validating shader.\n");
-                glfwTerminate();
-                glDeleteVertexArrays(1, &fullscreen_triangle_vao);
-                delete[] buffer.data;
-                return -1;
-        }
+        if(!renderer->program) return false;
 
-        glUseProgram(shader_id);
+        glUseProgram(renderer->program);
 
         /* attach texture to uniform sampler2D var in the fragment shader */
-        GLint location = glGetUniformLocation(shader_id, "buffer");
+        GLint location = glGetUniformLocation(renderer->program, "buffer");
         glUniform1i(location, 0);
 
+        if(renderer->packed_framebuffer)
+        {
+                uint32_t clear_color = parent->clear_color;
+                glUniform1i(glGetUniformLocation(renderer->program, "overlay"), 1);
+                glUniform2i(glGetUniformLocation(renderer->program, "buffer_size"), buffer.width, buffer.height);
+                glUniform3f(glGetUniformLocation(renderer->program, "background"),
+                            ((clear_color >> pixel_format.r_shift) & 0xFF) / 255.0f,
+                            ((clear_color >> pixel_format.g_shift) & 0xFF) / 255.0f,
+                            ((clear_color >> pixel_format.b_shift) & 0xFF) / 255.0f);
+        }
+
         //OpenGL setup
         glDisable(GL_DEPTH_TEST);
         glActiveTexture(GL_TEXTURE0);
 
-        glBindVertexArray(fullscreen_triangle_vao);
-
-        // Prepare game
-        Sprite alien_sprites[6];
-
-        alien_sprites[0].width = 8;
-        alien_sprites[0].height = 8;
-        alien_sprites[0].data = new uint8_t[64]
-        {
-                0,0,0,1,1,0,0,0, // ...@@...
-                0,0,1,1,1,1,0,0, // ..@@@@..
-                0,1,1,1,1,1,1,0, // .@@@@@@.
-                1,1,0,1,1,0,1,1, // @@.@@.@@
-                1,1,1,1,1,1,1,1, // @@@@@@@@
-                0,1,0,1,1,0,1,0, // .@.@@.@.
-                1,0,0,0,0,0,0,1, // @......@
-                0,1,0,0,0,0,1,0  // .@....@.
-        };
+        glBindVertexArray(renderer->vao);
 
-        alien_sprites[1].width = 8;
-        alien_sprites[1].height = 8;
-        alien_sprites[1].data = new uint8_t[64]
-        {
-                0,0,0,1,1,0,0,0, // ...@@...
-                0,0,1,1,1,1,0,0, // ..@@@@..
-                0,1,1,1,1,1,1,0, // .@@@@@@.
-                1,1,0,1,1,0,1,1, // @@.@@.@@
-                1,1,1,1,1,1,1,1, // @@@@@@@@
-                0,0,1,0,0,1,0,0, // ..@..@..
-                0,1,0,1,1,0,1,0, // .@.@@.@.
-                1,0,1,0,0,1,0,1  // @.@..@.@
-        };
+        return true;
+}
 
-        alien_sprites[2].width = 11;
-        alien_sprites[2].height = 8;
-        alien_sprites[2].data = new uint8_t[88]
-        {
-                0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
-                0,0,0,1,0,0,0,1,0,0,0, // ...@...@...
-                0,0,1,1,1,1,1,1,1,0,0, // ..@@@@@@@..
-                0,1,1,0,1,1,1,0,1,1,0, // .@@.@@@.@@.
-                1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-                1,0,1,1,1,1,1,1,1,0,1, // @.@@@@@@@.@
-                1,0,1,0,0,0,0,0,1,0,1, // @.@.....@.@
-                0,0,0,1,1,0,1,1,0,0,0  // ...@@.@@...
-        };
+void cpu_renderer_destroy(CpuRenderer* renderer, const Renderer* parent)
+{
+        DirtyTracker& dirty_tracker = renderer->dirty_tracker;
+        const Buffer& buffer = renderer->buffer;
 
-        alien_sprites[3].width = 11;
-        alien_sprites[3].height = 8;
-        alien_sprites[3].data = new uint8_t[88]
-        {
-                0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
-                1,0,0,1,0,0,0,1,0,0,1, // @..@...@..@
-                1,0,1,1,1,1,1,1,1,0,1, // @.@@@@@@@.@
-                1,1,1,0,1,1,1,0,1,1,1, // @@@.@@@.@@@
-                1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-                0,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@.
-                0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
-                0,1,0,0,0,0,0,0,0,1,0  // .@.......@.
-        };
+        if(dirty_tracker.num_frames > 0)
+        {
+                size_t full_frame = buffer.width * buffer.height;
+                printf("Dirty tracking over %zu frames: %.0f pixels touched, %.0f bytes uploaded per frame"
+                       " (full redraw: %zu pixels, %zu bytes)\n",
+                       dirty_tracker.num_frames,
+                       (double)dirty_tracker.pixels_touched / dirty_tracker.num_frames,
+                       (double)dirty_tracker.bytes_uploaded / dirty_tracker.num_frames,
+                       full_frame, full_frame * sizeof(uint32_t));
+                printf("Static layers: %.0f pixels redrawn per frame\n",
+                       (double)dirty_tracker.base_pixels_touched / dirty_tracker.num_frames);
+                printf("Draw lists: %.1f commands, %.1f binned, %.1f points, %.3f ms diff/bin/raster per frame\n",
+                       (double)dirty_tracker.commands_recorded / dirty_tracker.num_frames,
+                       (double)dirty_tracker.commands_binned / dirty_tracker.num_frames,
+                       (double)dirty_tracker.points_recorded / dirty_tracker.num_frames,
+                       1000.0 * dirty_tracker.raster_seconds / dirty_tracker.num_frames);
+        }
+        if(renderer->packed_framebuffer && parent->num_frames > 0)
+        {
+                printf("1bpp framebuffer: %llu bytes uploaded, %llu static layer pixels redrawn\n",
+                       (unsigned long long)renderer->packed_bytes_uploaded,
+                       (unsigned long long)dirty_tracker.base_pixels_touched);
+        }
 
-        alien_sprites[4].width = 12;
-        alien_sprites[4].height = 8;
-        alien_sprites[4].data = new uint8_t[96]
-        {
-                0,0,0,0,1,1,1,1,0,0,0,0, // ....@@@@....
-                0,1,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@@.
-                1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
-                1,1,1,0,0,1,1,0,0,1,1,1, // @@@..@@..@@@
-                1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
-                0,0,0,1,1,0,0,1,1,0,0,0, // ...@@..@@...
-                0,0,1,1,0,1,1,0,1,1,0,0, // ..@@.@@.@@..
-                1,1,0,0,0,0,0,0,0,0,1,1  // @@........@@
-        };
+        if(renderer->use_pbo_ring)
+        {
+                printf("PBO ring: %llu stalls waiting for the GPU\n", (unsigned long long)renderer->pbo_ring.stalls);
+                pbo_ring_destroy(&renderer->pbo_ring);
+        }
 
+        dirty_tracker_destroy(&dirty_tracker);
+        worker_pool_destroy(&renderer->raster_pool);
 
-        alien_sprites[5].width = 12;
-        alien_sprites[5].height = 8;
-        alien_sprites[5].data = new uint8_t[96]
-        {
-                0,0,0,0,1,1,1,1,0,0,0,0, // ....@@@@....
-                0,1,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@@.
-                1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
-                1,1,1,0,0,1,1,0,0,1,1,1, // @@@..@@..@@@
-                1,1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@@
-                0,0,1,1,1,0,0,1,1,1,0,0, // ..@@@..@@@..
-                0,1,1,0,0,1,1,0,0,1,1,0, // .@@..@@..@@.
-                0,0,1,1,0,0,0,0,1,1,0,0  // ..@@....@@..
-        };
+        if(renderer->program) glDeleteProgram(renderer->program);
+        glDeleteVertexArrays(1, &renderer->vao);
+        glDeleteTextures(1, &renderer->buffer_texture);
+        if(renderer->overlay_texture) glDeleteTextures(1, &renderer->overlay_texture);
 
-        Sprite alien_death_sprite;
-        alien_death_sprite.width = 13;
-        alien_death_sprite.height = 7;
-        alien_death_sprite.data = new uint8_t[91]
-        {
-                0,1,0,0,1,0,0,0,1,0,0,1,0, // .@..@...@..@.
-                0,0,1,0,0,1,0,1,0,0,1,0,0, // ..@..@.@..@..
-                0,0,0,1,0,0,0,0,0,1,0,0,0, // ...@.....@...
-                1,1,0,0,0,0,0,0,0,0,0,1,1, // @@.........@@
-                0,0,0,1,0,0,0,0,0,1,0,0,0, // ...@.....@...
-                0,0,1,0,0,1,0,1,0,0,1,0,0, // ..@..@.@..@..
-                0,1,0,0,1,0,0,0,1,0,0,1,0  // .@..@...@..@.
-        };
+        bit_buffer_destroy(&renderer->bit_buffer);
+        delete[] renderer->buffer.data;
+}
 
+void cpu_renderer_end_frame(CpuRenderer* renderer, uint32_t clear_color)
+{
+        Buffer& buffer = renderer->buffer;
+        BitBuffer& bit_buffer = renderer->bit_buffer;
+        DirtyTracker& dirty_tracker = renderer->dirty_tracker;
+        PboRing* pbo_ring = &renderer->pbo_ring;
 
-        Sprite player_sprite;
-        player_sprite.width = 11;
-        player_sprite.height = 7;
-        player_sprite.data = new uint8_t[77]
+        if(renderer->packed_framebuffer)
         {
-                0,0,0,0,0,1,0,0,0,0,0, // .....@.....
-                0,0,0,0,1,1,1,0,0,0,0, // ....@@@....
-                0,0,0,0,1,1,1,0,0,0,0, // ....@@@....
-                0,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@.
-                1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-                1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-                1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-        };
+                dirty_tracker_end_frame_bits(&dirty_tracker, &bit_buffer, clear_color);
+        }
+        else
+        {
+                dirty_tracker_end_frame(&dirty_tracker, &buffer, clear_color, &renderer->raster_pool);
+        }
 
-        Sprite text_spritesheet;
-        text_spritesheet.width = 5;
-        text_spritesheet.height = 7;
-        text_spritesheet.data = new uint8_t[65 * 35] // 65 chars with size 5x7
-        {
-                0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-                0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,0,0,1,0,0,
-                0,1,0,1,0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-                0,1,0,1,0,0,1,0,1,0,1,1,1,1,1,0,1,0,1,0,1,1,1,1,1,0,1,0,1,0,0,1,0,1,0,
-                0,0,1,0,0,0,1,1,1,0,1,0,1,0,0,0,1,1,1,0,0,0,1,0,1,0,1,1,1,0,0,0,1,0,0,
-                1,1,0,1,0,1,1,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,1,1,0,1,0,1,1,
-                0,1,1,0,0,1,0,0,1,0,1,0,0,1,0,0,1,1,0,0,1,0,0,1,0,1,0,0,0,1,0,1,1,1,1,
-                0,0,0,1,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-                0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,
-                1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,
-                0,0,1,0,0,1,0,1,0,1,0,1,1,1,0,0,0,1,0,0,0,1,1,1,0,1,0,1,0,1,0,0,1,0,0,
-                0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,1,1,1,1,1,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,
-                0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,
-                0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-                0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,
-                0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,
-
-                0,1,1,1,0,1,0,0,0,1,1,0,0,1,1,1,0,1,0,1,1,1,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                0,0,1,0,0,0,1,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,1,1,0,
-                0,1,1,1,0,1,0,0,0,1,0,0,0,0,1,0,0,1,1,0,0,1,0,0,0,1,0,0,0,0,1,1,1,1,1,
-                1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,1,0,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                0,0,0,1,0,0,0,1,1,0,0,1,0,1,0,1,0,0,1,0,1,1,1,1,1,0,0,0,1,0,0,0,0,1,0,
-                1,1,1,1,1,1,0,0,0,0,1,1,1,1,0,0,0,0,0,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-
-                0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,
-                0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,
-                0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,
-                0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,
-                1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,
-                0,1,1,1,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,0,0,1,0,0,
-                0,1,1,1,0,1,0,0,0,1,1,0,1,0,1,1,1,0,1,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,0,
-
-                0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,1,1,0,0,0,1,1,0,0,0,1,
-                1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,1,1,1,0,
-                1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,
-                1,1,1,1,1,1,0,0,0,0,1,0,0,0,0,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,1,1,1,1,
-                1,1,1,1,1,1,0,0,0,0,1,0,0,0,0,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,0,1,1,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,1,1,1,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,
-                0,1,1,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,1,1,0,
-                0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                1,0,0,0,1,1,0,0,1,0,1,0,1,0,0,1,1,0,0,0,1,0,1,0,0,1,0,0,1,0,1,0,0,0,1,
-                1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,1,1,1,1,
-                1,0,0,0,1,1,1,0,1,1,1,0,1,0,1,1,0,1,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,
-                1,0,0,0,1,1,0,0,0,1,1,1,0,0,1,1,0,1,0,1,1,0,0,1,1,1,0,0,0,1,1,0,0,0,1,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,1,0,1,1,0,0,1,1,0,1,1,1,1,
-                1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,1,0,0,1,0,0,1,0,1,0,0,0,1,
-                0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,0,1,1,1,0,1,0,0,0,1,0,0,0,0,1,0,1,1,1,0,
-                1,1,1,1,1,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,
-                1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-                1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,
-                1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,1,0,1,1,0,1,0,1,1,1,0,1,1,1,0,0,0,1,
-                1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,1,0,0,0,1,
-                1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,
-                1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,1,1,1,1,
-
-                0,0,0,1,1,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,1,
-                0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,
-                1,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,1,1,0,0,0,
-                0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-                0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,
-                0,0,1,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
-        };
+        /* Upload the frame. With the PBO ring the frame is first copied
+         * into the ring's next buffer and the texture is updated from
+         * offsets into that buffer instead of from client memory. */
+        bool upload = renderer->packed_framebuffer || dirty_tracker.num_regions > 0;
+        uint8_t* staging = renderer->use_pbo_ring && upload? pbo_ring_map(pbo_ring): 0;
 
-        Sprite number_spritesheet = text_spritesheet;
-        number_spritesheet.data += 16 * 35;
+        if(renderer->packed_framebuffer)
+        {
+                size_t bytes = renderer->bit_buffer_row_bytes * bit_buffer.height;
+                uintptr_t source = (uintptr_t)bit_buffer.data;
+                if(staging)
+                {
+                        memcpy(staging, bit_buffer.data, bytes);
+                        pbo_ring_unmap(pbo_ring);
+                        source = 0;
+                }
 
-        Sprite bullet_sprite;
-        bullet_sprite.width = 1;
-        bullet_sprite.height = 3;
-        bullet_sprite.data = new uint8_t[3]
+                glTexSubImage2D(
+                    GL_TEXTURE_2D, 0, 0, 0,
+                    renderer->bit_buffer_row_bytes, bit_buffer.height,
+                    GL_RED_INTEGER, GL_UNSIGNED_BYTE,
+                    (const void*)source
+                );
+                renderer->packed_bytes_uploaded += bytes;
+        }
+        else if(upload)
         {
-                1, // @
-                1, // @
-                1  // @
-        };
+                /* The staging buffer has the layout of the whole buffer,
+                 * only the dirty regions are copied into it */
+                uintptr_t source = (uintptr_t)buffer.data;
+                if(staging)
+                {
+                        for(size_t ri = 0; ri < dirty_tracker.num_regions; ++ri)
+                        {
+                                const Rect& region = dirty_tracker.regions[ri];
+                                for(size_t yi = region.y; yi < region.y + region.height; ++yi)
+                                {
+                                        size_t offset = (yi * buffer.width + region.x) * sizeof(uint32_t);
+                                        memcpy(staging + offset, (const uint8_t*)buffer.data + offset,
+                                               region.width * sizeof(uint32_t));
+                                }
+                        }
+                        pbo_ring_unmap(pbo_ring);
+                        source = 0;
+                }
 
-        SpriteAnimation alien_animation[3];
+                /* Upload only the dirty regions, GL_UNPACK_ROW_LENGTH is the buffer width */
+                for(size_t ri = 0; ri < dirty_tracker.num_regions; ++ri)
+                {
+                        const Rect& region = dirty_tracker.regions[ri];
+                        size_t offset = (region.y * buffer.width + region.x) * sizeof(uint32_t);
+                        glTexSubImage2D(
+                            GL_TEXTURE_2D, 0, region.x, region.y,
+                            region.width, region.height,
+                            upload_format->format, upload_format->type,
+                            (const void*)(source + offset)
+                        );
+                }
+        }
+
+        if(staging) pbo_ring_fence(pbo_ring);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
 
-        for(size_t i = 0; i < 3; ++i)
+bool gpu_renderer_init(GpuRenderer* renderer, const RendererConfig& config, Renderer* parent)
+{
+        // Colors are packed with the default format's shifts and unpacked by the shader
+        parent->clear_color = rgb_to_uint32(config.clear_r, config.clear_g, config.clear_b);
+
+        draw_list_init(&renderer->list, 256, config.height);
+        renderer->instances_drawn = 0;
+        renderer->dynamic_rows_uploaded = 0;
+
+        // Lay out the baked tables, keeping only the unshifted copy of each row
+        renderer->num_static_rows = 0;
+        for(size_t ti = 0; ti < NUM_SPRITE_TABLES; ++ti)
         {
-                alien_animation[i].loop = true;
-                alien_animation[i].num_frames = 2;
-                alien_animation[i].frame_duration = 50; // old val: 10
-                alien_animation[i].time = 0;
+                renderer->table_offsets[ti] = renderer->num_static_rows;
+                renderer->num_static_rows += sprite_tables[ti].num_rows;
+        }
 
-                alien_animation[i].frames = new Sprite*[2];
-                alien_animation[i].frames[0] = &alien_sprites[2 * i];
-                alien_animation[i].frames[1] = &alien_sprites[2 * i + 1];
+        renderer->num_rows = renderer->num_static_rows;
+        renderer->rows_capacity = renderer->num_static_rows + 256;
+        renderer->rows = new uint32_t[2 * renderer->rows_capacity];
+        for(size_t ti = 0; ti < NUM_SPRITE_TABLES; ++ti)
+        {
+                const SpriteTable& table = sprite_tables[ti];
+                uint32_t* dst = renderer->rows + 2 * renderer->table_offsets[ti];
+                for(size_t yi = 0; yi < table.num_rows; ++yi)
+                {
+                        uint64_t row = table.rows[yi * SPRITE_NUM_SHIFTS];
+                        dst[2 * yi + 0] = (uint32_t)row;
+                        dst[2 * yi + 1] = (uint32_t)(row >> 32);
+                }
         }
 
-        Game game;
-        game.width = buffer_width;
-        game.height = buffer_height;
-        game.num_bullets = 0;
-        game.num_aliens = 55;
-        game.aliens = new Alien[game.num_aliens];
+        renderer->instances_capacity = 256;
+        renderer->instances = new uint32_t[4 * renderer->instances_capacity];
+
+        glGenBuffers(1, &renderer->rows_buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, renderer->rows_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 2 * renderer->rows_capacity * sizeof(uint32_t),
+                     renderer->rows, GL_DYNAMIC_DRAW);
+
+        glGenBuffers(1, &renderer->instance_buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, renderer->instance_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 4 * renderer->instances_capacity * sizeof(uint32_t), 0, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenTextures(1, &renderer->rows_texture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, renderer->rows_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, renderer->rows_buffer);
+
+        glGenTextures(1, &renderer->instance_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, renderer->instance_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, renderer->instance_buffer);
+        glActiveTexture(GL_TEXTURE0);
+
+        // Quads are generated from gl_VertexID and gl_InstanceID, the vao
+        // has no attributes
+        glGenVertexArrays(1, &renderer->vao);
+
+        static const char* vertex_shader =
+                "\n"
+                "#version 330\n"
+                "\n"
+                "uniform usamplerBuffer instances;\n"
+                "uniform vec2 buffer_size;\n"
+                "uniform int first_point;\n"
+                "flat out uvec4 Sprite;\n"
+                "noperspective out vec2 SpriteCoord;\n"
+                "\n"
+                "void main(void){\n"
+                "    bool point = first_point >= 0;\n"
+                "    uvec4 instance = texelFetch(instances, point? first_point + gl_VertexID: gl_InstanceID);\n"
+                "    uvec2 size = uvec2(instance.y & 0xFFFFu, instance.y >> 16);\n"
+                "    vec2 origin = vec2(instance.x & 0xFFFFu, instance.x >> 16);\n"
+                "    vec2 corner = point? vec2(0.5): vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+                "    SpriteCoord = corner * vec2(size);\n"
+                "    Sprite = uvec4(size, instance.zw);\n"
+                "    gl_Position = vec4(2.0 * (origin + SpriteCoord) / buffer_size - 1.0, 0.0, 1.0);\n"
+                "}\n";
+
+        // Sprite row 0 is the top row, so the bottom row of the quad
+        // is the last row of the sprite
+        static const char* fragment_shader =
+                "\n"
+                "#version 330\n"
+                "\n"
+                "uniform usamplerBuffer sprite_rows;\n"
+                "uniform uvec3 color_shifts;\n"
+                "flat in uvec4 Sprite;\n"
+                "noperspective in vec2 SpriteCoord;\n"
+                "\n"
+                "out vec3 outColor;\n"
+                "\n"
+                "void main(void){\n"
+                "    if(Sprite.z != 0xFFFFFFFFu){\n"
+                "        ivec2 pixel = ivec2(SpriteCoord);\n"
+                "        uvec2 row = texelFetch(sprite_rows, int(Sprite.z + Sprite.y) - 1 - pixel.y).rg;\n"
+                "        uint bits = pixel.x < 32? row.x: row.y;\n"
+                "        if(((bits >> uint(pixel.x & 31)) & 1u) == 0u) discard;\n"
+                "    }\n"
+                "    outColor = vec3((uvec3(Sprite.w) >> color_shifts) & 0xFFu) / 255.0;\n"
+                "}\n";
+
+        renderer->program = shader_program_create(vertex_shader, fragment_shader);
+        if(!renderer->program) return false;
+
+        glUseProgram(renderer->program);
+        glUniform1i(glGetUniformLocation(renderer->program, "sprite_rows"), 0);
+        glUniform1i(glGetUniformLocation(renderer->program, "instances"), 1);
+        glUniform2f(glGetUniformLocation(renderer->program, "buffer_size"), config.width, config.height);
+        renderer->first_point_location = glGetUniformLocation(renderer->program, "first_point");
+        glUniform3ui(glGetUniformLocation(renderer->program, "color_shifts"),
+                     pixel_format.r_shift, pixel_format.g_shift, pixel_format.b_shift);
+
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(renderer->vao);
+
+        uint32_t clear_color = parent->clear_color;
+        glClearColor(((clear_color >> pixel_format.r_shift) & 0xFF) / 255.0f,
+                     ((clear_color >> pixel_format.g_shift) & 0xFF) / 255.0f,
+                     ((clear_color >> pixel_format.b_shift) & 0xFF) / 255.0f, 1.0f);
 
-        game.player.x = 112 - 5;
-        game.player.y = 32;
+        printf("Sprite rows: %zu uploaded to the GPU\n", renderer->num_static_rows);
+        return true;
+}
+
+void gpu_renderer_destroy(GpuRenderer* renderer, const Renderer* parent)
+{
+        if(parent->num_frames > 0)
+        {
+                printf("GPU sprites: %.1f instances, %.1f run-time sprite rows per frame\n",
+                       (double)renderer->instances_drawn / parent->num_frames,
+                       (double)renderer->dynamic_rows_uploaded / parent->num_frames);
+        }
+
+        if(renderer->program) glDeleteProgram(renderer->program);
+        glDeleteVertexArrays(1, &renderer->vao);
+        glDeleteTextures(1, &renderer->rows_texture);
+        glDeleteTextures(1, &renderer->instance_texture);
+        glDeleteBuffers(1, &renderer->rows_buffer);
+        glDeleteBuffers(1, &renderer->instance_buffer);
 
-        game.player.life = 3;
+        draw_list_destroy(&renderer->list);
+        delete[] renderer->rows;
+        delete[] renderer->instances;
+}
 
-        for(size_t yi = 0; yi < 5; ++yi)
+// Returns the first row of sprite in the rows buffer, appending the
+// sprite's rows to the run-time part if it is not a baked sprite
+size_t gpu_renderer_sprite_rows(GpuRenderer* renderer, const Sprite& sprite)
+{
+        for(size_t ti = 0; ti < NUM_SPRITE_TABLES; ++ti)
         {
-                for(size_t xi = 0; xi < 11; ++xi)
+                const SpriteTable& table = sprite_tables[ti];
+                if(sprite.rows >= table.rows && sprite.rows < table.rows + table.num_rows * SPRITE_NUM_SHIFTS)
                 {
-                        Alien& alien = game.aliens[yi * 11 + xi];
-                        alien.type = (5 - yi) / 2 + 1;
+                        return renderer->table_offsets[ti] + (sprite.rows - table.rows) / SPRITE_NUM_SHIFTS;
+                }
+        }
 
-                        const Sprite& sprite = alien_sprites[2 * (alien.type - 1)];
+        if(renderer->num_rows + sprite.height > renderer->rows_capacity)
+        {
+                size_t capacity = 2 * (renderer->num_rows + sprite.height);
+                uint32_t* rows = new uint32_t[2 * capacity];
+                memcpy(rows, renderer->rows, 2 * renderer->num_rows * sizeof(uint32_t));
+                delete[] renderer->rows;
+                renderer->rows = rows;
+                renderer->rows_capacity = capacity;
+        }
 
-                        alien.x = 16 * xi + 20 + (alien_death_sprite.width - sprite.width)/2;
-                        alien.y = 17 * yi + 128;
-                }
+        size_t first_row = renderer->num_rows;
+        uint32_t* dst = renderer->rows + 2 * first_row;
+        for(size_t yi = 0; yi < sprite.height; ++yi)
+        {
+                uint64_t row = sprite.rows[yi * SPRITE_NUM_SHIFTS];
+                dst[2 * yi + 0] = (uint32_t)row;
+                dst[2 * yi + 1] = (uint32_t)(row >> 32);
         }
+        renderer->num_rows += sprite.height;
+
+        return first_row;
+}
+
+void gpu_renderer_end_frame(GpuRenderer* renderer)
+{
+        DrawList* list = &renderer->list;
+        draw_list_sort(list);
 
-        uint8_t* death_counters = new uint8_t[game.num_aliens];
-        for(size_t i = 0; i < game.num_aliens; ++i)
+        if(list->num_commands + list->num_points > renderer->instances_capacity)
         {
-                death_counters[i] = 10;
+                delete[] renderer->instances;
+                renderer->instances_capacity = 2 * (list->num_commands + list->num_points);
+                renderer->instances = new uint32_t[4 * renderer->instances_capacity];
         }
 
-        uint32_t clear_color = rgb_to_uint32(0, 128, 0);
-        size_t score = 0;
-        size_t credits = 0;
-        game_running = true;
-        int player_move_dir = 0;
+        size_t rows_capacity = renderer->rows_capacity;
+        renderer->num_rows = renderer->num_static_rows;
 
-        /* Render Loop */
-        while (!glfwWindowShouldClose(window) && game_running)
+        size_t num_instances = 0;
+        for(size_t i = 0; i < list->num_commands; ++i)
+        {
+                const DrawCommand& command = list->commands[i];
+                if(command.x > 0xFFFF || command.y > 0xFFFF) continue;
+
+                uint32_t* instance = renderer->instances + 4 * num_instances++;
+                instance[0] = (uint32_t)(command.x | command.y << 16);
+                instance[1] = (uint32_t)(command.sprite.width | command.sprite.height << 16);
+                instance[2] = command.sprite.rows? (uint32_t)gpu_renderer_sprite_rows(renderer, command.sprite): GPU_SOLID_RECT;
+                instance[3] = command.color;
+        }
+
+        // Points are 1x1 solid instances, drawn after the commands since
+        // they belong to the last layer
+        size_t num_quads = num_instances;
+        for(size_t i = 0; i < list->num_points; ++i)
+        {
+                const DrawPoint& point = list->points[i];
+                uint32_t* instance = renderer->instances + 4 * num_instances++;
+                instance[0] = (uint32_t)point.x | (uint32_t)point.y << 16;
+                instance[1] = 1u | 1u << 16;
+                instance[2] = GPU_SOLID_RECT;
+                instance[3] = point.color;
+        }
+
+        // Baked rows stay put, only the rows appended this frame are sent
+        // unless the buffer had to grow
+        size_t num_dynamic_rows = renderer->num_rows - renderer->num_static_rows;
+        glBindBuffer(GL_TEXTURE_BUFFER, renderer->rows_buffer);
+        if(renderer->rows_capacity != rows_capacity)
         {
-                buffer_clear(&buffer, clear_color);
+                glBufferData(GL_TEXTURE_BUFFER, 2 * renderer->rows_capacity * sizeof(uint32_t),
+                             renderer->rows, GL_DYNAMIC_DRAW);
+        }
+        else if(num_dynamic_rows > 0)
+        {
+                glBufferSubData(GL_TEXTURE_BUFFER, 2 * renderer->num_static_rows * sizeof(uint32_t),
+                                2 * num_dynamic_rows * sizeof(uint32_t),
+                                renderer->rows + 2 * renderer->num_static_rows);
+        }
 
-                /* Draw */
-                buffer_draw_text(&buffer, text_spritesheet, "SCORE", 4, game.height - text_spritesheet.height - 7, rgb_to_uint32(128, 0, 0));
+        // Orphan the instance buffer so the upload does not wait for the
+        // previous frame's draw
+        glBindBuffer(GL_TEXTURE_BUFFER, renderer->instance_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 4 * renderer->instances_capacity * sizeof(uint32_t), 0, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, 4 * num_instances * sizeof(uint32_t), renderer->instances);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
 
-                char credit_text[16];
-                sprintf(credit_text, "CREDIT %02zu", credits);
-                buffer_draw_text(&buffer, text_spritesheet, credit_text, 164, 7, rgb_to_uint32(128, 0, 0));
+        glClear(GL_COLOR_BUFFER_BIT);
+        if(num_quads > 0)
+        {
+                glUniform1i(renderer->first_point_location, -1);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, num_quads);
+        }
+        if(num_instances > num_quads)
+        {
+                glUniform1i(renderer->first_point_location, num_quads);
+                glDrawArrays(GL_POINTS, 0, num_instances - num_quads);
+        }
 
-                buffer_draw_number(&buffer, number_spritesheet, score, 4 + 2 * number_spritesheet.width, game.height - 2 * number_spritesheet.height - 12, rgb_to_uint32(128, 0, 0));
+        renderer->instances_drawn += num_instances;
+        renderer->dynamic_rows_uploaded += num_dynamic_rows;
+}
 
-                /* Draw a solid line across the screen */
-                for(size_t i = 0; i < game.width; ++i)
+bool renderer_init(Renderer* renderer, const RendererConfig& config)
+{
+        renderer->backend = config.backend;
+        renderer->width = config.width;
+        renderer->height = config.height;
+        renderer->num_frames = 0;
+        renderer->end_frame_seconds = 0;
+        printf("Render backend: %s\n", renderer_backend_names[config.backend]);
+
+        switch(config.backend)
+        {
+        case RENDERER_CPU:
+                return cpu_renderer_init(&renderer->cpu, config, renderer);
+        case RENDERER_GPU:
+                return gpu_renderer_init(&renderer->gpu, config, renderer);
+        case RENDERER_NULL:
+                renderer->clear_color = rgb_to_uint32(config.clear_r, config.clear_g, config.clear_b);
+                draw_list_init(&renderer->null_list, 256, config.height);
+                return true;
+        }
+
+        return false;
+}
+
+void renderer_destroy(Renderer* renderer)
+{
+        if(renderer->num_frames > 0)
+        {
+                printf("Renderer %s: %zu frames, %.3f ms per frame to render and submit\n",
+                       renderer_backend_names[renderer->backend], renderer->num_frames,
+                       1000.0 * renderer->end_frame_seconds / renderer->num_frames);
+        }
+
+        switch(renderer->backend)
+        {
+        case RENDERER_CPU:
+                cpu_renderer_destroy(&renderer->cpu, renderer);
+                break;
+        case RENDERER_GPU:
+                gpu_renderer_destroy(&renderer->gpu, renderer);
+                break;
+        case RENDERER_NULL:
+                draw_list_destroy(&renderer->null_list);
+                break;
+        }
+}
+
+// Returns the empty list the next frame should be recorded into
+DrawList* renderer_begin_frame(Renderer* renderer)
+{
+        switch(renderer->backend)
+        {
+        case RENDERER_CPU:
+                return dirty_tracker_begin_frame(&renderer->cpu.dirty_tracker);
+        case RENDERER_GPU:
+                draw_list_reset(&renderer->gpu.list);
+                return &renderer->gpu.list;
+        case RENDERER_NULL:
+                break;
+        }
+
+        draw_list_reset(&renderer->null_list);
+        return &renderer->null_list;
+}
+
+// Renders the recorded frame into the current framebuffer
+void renderer_end_frame(Renderer* renderer)
+{
+        auto start = std::chrono::steady_clock::now();
+
+        switch(renderer->backend)
+        {
+        case RENDERER_CPU:
+                cpu_renderer_end_frame(&renderer->cpu, renderer->clear_color);
+                break;
+        case RENDERER_GPU:
+                gpu_renderer_end_frame(&renderer->gpu);
+                break;
+        case RENDERER_NULL:
+                break;
+        }
+
+        renderer->end_frame_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++renderer->num_frames;
+}
+
+// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
+// ---------------------------------------------------------------------------------------------------------
+void processInput(GLFWwindow *window)
+{
+        if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
+                glfwSetWindowShouldClose(window, true);
+        }
+}
+
+// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+// ---------------------------------------------------------------------------------------------
+void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+        // make sure the viewport matches the new window dimensions; note that width and 
+        // height will be significantly larger than specified on retina displays.
+        glViewport(0, 0, width, height);
+}
+
+int main(int argc, char* argv[])
+{
+        const size_t buffer_width = 224;
+        const size_t buffer_height = 256;
+
+        RendererConfig renderer_config;
+        renderer_config.backend = RENDERER_CPU;
+        renderer_config.width = buffer_width;
+        renderer_config.height = buffer_height;
+        renderer_config.clear_r = 0;
+        renderer_config.clear_g = 128;
+        renderer_config.clear_b = 0;
+        renderer_config.packed_framebuffer = false;
+        renderer_config.use_pbo_ring = true;
+
+        // Texture upload format, picked by timing all of them at startup
+        // unless pinned with --upload-format or SPACE_INVADERS_UPLOAD_FORMAT
+        renderer_config.upload_format_name = getenv("SPACE_INVADERS_UPLOAD_FORMAT");
+
+        // Rasterizer worker threads in addition to the render thread
+        size_t num_raster_workers = std::thread::hardware_concurrency();
+        num_raster_workers = num_raster_workers > 1? num_raster_workers - 1: 0;
+        if(num_raster_workers > 7) num_raster_workers = 7;
+
+        GameConfig game_config;
+        game_config.width = buffer_width;
+        game_config.height = buffer_height;
+        game_config.collision_mode = COLLISION_FORMATION;
+        game_config.num_sim_workers = 0;
+        game_config.particle_stress = 0;
+        game_config.bullet_stress = 0;
+
+        // Present with vsync, and simulate at GAME_TICKS_PER_SECOND whatever
+        // the display rate. --lockstep runs one tick per presented frame
+        // instead, which makes runs repeatable frame for frame.
+        bool vsync = true;
+        bool lockstep = false;
+
+        // Input of every tick is written here on exit, for the headless
+        // front end to replay
+        const char* record_path = 0;
+
+        for(int i = 1; i < argc; ++i)
+        {
+                if(strcmp(argv[i], "--bench-clear") == 0)
                 {
-                        buffer.data[game.width * 16 + i] = rgb_to_uint32(128, 0, 0);
+                        buffer_clear_benchmark();
+                        return 0;
                 }
-
-                for(size_t ai = 0; ai < game.num_aliens; ++ai)
+                else if(strcmp(argv[i], "--renderer") == 0 && i + 1 < argc)
                 {
-                        if(!death_counters[ai]) continue;
-
-                        const Alien& alien = game.aliens[ai];
-                        if(alien.type == ALIEN_DEAD)
-                        {
-                                buffer_draw_sprite(&buffer, alien_death_sprite, alien.x, alien.y, rgb_to_uint32(128, 0, 0));
-                        }
-                        else
-                        {
-                                const SpriteAnimation& animation = alien_animation[alien.type - 1];
-                                size_t current_frame = animation.time / animation.frame_duration;
-                                const Sprite& sprite = *animation.frames[current_frame];
-                                buffer_draw_sprite(&buffer, sprite, alien.x, alien.y, rgb_to_uint32(128, 0, 0));
-                        }
+                        const char* name = argv[++i];
+                        if(strcmp(name, "cpu") == 0) renderer_config.backend = RENDERER_CPU;
+                        else if(strcmp(name, "gpu") == 0) renderer_config.backend = RENDERER_GPU;
+                        else if(strcmp(name, "null") == 0) renderer_config.backend = RENDERER_NULL;
+                        else fprintf(stderr, "Unknown renderer %s, using cpu\n", name);
                 }
-
-                for(size_t bi = 0; bi < game.num_bullets; ++bi)
+                else if(strcmp(argv[i], "--upload-format") == 0 && i + 1 < argc)
                 {
-                        const Bullet& bullet = game.bullets[bi];
-                        const Sprite& sprite = bullet_sprite;
-                        buffer_draw_sprite(&buffer, sprite, bullet.x, bullet.y, rgb_to_uint32(128, 0, 0));
+                        renderer_config.upload_format_name = argv[++i];
                 }
-
-                buffer_draw_sprite(&buffer, player_sprite, game.player.x, game.player.y, rgb_to_uint32(128, 0, 0));
-
-                /* Update animations */
-                for(size_t i = 0; i < 3; ++i)
+                else if(strcmp(argv[i], "--no-pbo") == 0)
                 {
-                        ++alien_animation[i].time;
-                        if(alien_animation[i].time == alien_animation[i].num_frames * alien_animation[i].frame_duration)
-                        {
-                                alien_animation[i].time = 0;
-                        }
+                        renderer_config.use_pbo_ring = false;
+                }
+                else if(strcmp(argv[i], "--1bpp") == 0)
+                {
+                        renderer_config.packed_framebuffer = true;
+                }
+                else if(strcmp(argv[i], "--raster-threads") == 0 && i + 1 < argc)
+                {
+                        // Total number of rasterizing threads, 1 rasterizes on the render thread only
+                        int num_threads = atoi(argv[++i]);
+                        num_raster_workers = num_threads > 1? num_threads - 1: 0;
                 }
+                else if(strcmp(argv[i], "--sim-threads") == 0 && i + 1 < argc)
+                {
+                        // Total number of simulation threads, including the main thread
+                        int num_threads = atoi(argv[++i]);
+                        game_config.num_sim_workers = num_threads > 1? num_threads - 1: 0;
+                }
+                else if(strcmp(argv[i], "--collision") == 0 && i + 1 < argc)
+                {
+                        const char* name = argv[++i];
+                        if(strcmp(name, "formation") == 0) game_config.collision_mode = COLLISION_FORMATION;
+                        else if(strcmp(name, "grid") == 0) game_config.collision_mode = COLLISION_GRID;
+                        else if(strcmp(name, "scan") == 0) game_config.collision_mode = COLLISION_SCAN;
+                        else fprintf(stderr, "Unknown collision mode %s, using formation\n", name);
+                }
+                else if(strcmp(argv[i], "--bullet-stress") == 0 && i + 1 < argc)
+                {
+                        game_config.bullet_stress = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--particle-stress") == 0 && i + 1 < argc)
+                {
+                        game_config.particle_stress = strtoul(argv[++i], 0, 10);
+                }
+                else if(strcmp(argv[i], "--no-vsync") == 0)
+                {
+                        vsync = false;
+                }
+                else if(strcmp(argv[i], "--lockstep") == 0)
+                {
+                        lockstep = true;
+                }
+                else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+                {
+                        record_path = argv[++i];
+                }
+        }
+        renderer_config.num_raster_workers = num_raster_workers;
 
-                glTexSubImage2D(
-                    GL_TEXTURE_2D, 0, 0, 0,
-                    buffer.width, buffer.height,
-                    GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,
-                    buffer.data
-                );
-                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glfwSetErrorCallback(error_callback);
 
-                // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-                // -------------------------------------------------------------------------------
-                glfwSwapBuffers(window);
+        if (!glfwInit()) return -1;
+        
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 
-                // Simulate aliens
-                for(size_t ai = 0; ai < game.num_aliens; ++ai)
-                {
-                        const Alien& alien = game.aliens[ai];
-                        if(alien.type == ALIEN_DEAD && death_counters[ai])
-                        {
-                                --death_counters[ai];
-                        }
-                }
+        GLFWwindow* window = glfwCreateWindow(buffer_width, buffer_height, "Space Invaders", NULL, NULL);
+        if (window == NULL)
+        {
+                std::cout << "Failed to create GLFW window" << std::endl;
+                glfwTerminate();
+                return -1;
+        }
 
-                /* Simulate the bullets */
-                for(size_t bi = 0; bi < game.num_bullets;)
-                {
-                        game.bullets[bi].y += game.bullets[bi].dir;
-                        if(game.bullets[bi].y >= game.height ||
-                           game.bullets[bi].y < bullet_sprite.height)
-                        {
-                                game.bullets[bi] = game.bullets[game.num_bullets - 1];
-                                --game.num_bullets;
-                                continue;
-                        }
+        glfwSetKeyCallback(window, key_callback);
 
-                        // Check hit
-                        for(size_t ai = 0; ai < game.num_aliens; ++ai)
-                        {
-                                const Alien& alien = game.aliens[ai];
-                                if(alien.type == ALIEN_DEAD) continue;
-
-                                const SpriteAnimation& animation = alien_animation[alien.type - 1];
-                                size_t current_frame = animation.time / animation.frame_duration;
-                                const Sprite& alien_sprite = *animation.frames[current_frame];
-                                bool overlap = sprite_overlap_check(
-                                        bullet_sprite, game.bullets[bi].x, game.bullets[bi].y,
-                                        alien_sprite, alien.x, alien.y
-                                );
-
-                                if(overlap)
-                                {
-                                        score += 10 * (4 - game.aliens[ai].type);
-                                        game.aliens[ai].type = ALIEN_DEAD;
-                                        // NOTE: Hack to recenter death sprite
-                                        game.aliens[ai].x -= (alien_death_sprite.width - alien_sprite.width)/2;
-                                        game.bullets[bi] = game.bullets[game.num_bullets - 1];
-                                        --game.num_bullets;
-                                        continue;
-                                }
-                        }
+        glfwMakeContextCurrent(window);
 
-                        ++bi;
-                }
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+        // glad: load all OpenGL function pointers
+        // ---------------------------------------
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+                std::cout << "Failed to initialize GLAD" << std::endl;
+                glfwTerminate();
+                return -1;
+        }
+        int glVersion[2] = {-1,1};
+        glGetIntegerv(GL_MAJOR_VERSION, &glVersion[0]);
+        glGetIntegerv(GL_MINOR_VERSION, &glVersion[1]);
+
+        gl_debug(__FILE__, __LINE__);
+
+        printf("Using OpenGL: %d.%d\n", glVersion[0], glVersion[1]);
+        printf("Renderer used: %s\n", glGetString(GL_RENDERER));
+        printf("Shading Language: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+
+        glfwSwapInterval(vsync? 1: 0);
+
+        // args: red, green, blue, alpha
+        glClearColor(1.0, 0.0, 0.0, 1.0);
 
-                // Simulate player
-                player_move_dir = 2 * move_dir;
+        Renderer* renderer = new Renderer;
+        if(!renderer_init(renderer, renderer_config))
+        {
+                renderer_destroy(renderer);
+                delete renderer;
+                glfwTerminate();
+                return -1;
+        }
+
+        // Prepare game
+        Game* game = new Game;
+        game_init(game, game_config);
+
+        InputLog record;
+        input_log_init(&record, game_config, REPLAY_DEFAULT_KEYFRAME_INTERVAL);
+
+        game_running = true;
+
+        GameClock clock;
+        game_clock_init(&clock, GAME_TICKS_PER_SECOND, GAME_MAX_CATCHUP_TICKS);
+        float alpha = 1.0f;
+
+        // Whole-loop throughput, to compare backends on the same machine
+        auto loop_start = std::chrono::steady_clock::now();
+        auto frame_start = loop_start;
+
+        /* Render Loop */
+        while (!glfwWindowShouldClose(window) && game_running)
+        {
+                DrawList* draw_list = renderer_begin_frame(renderer);
+                game_draw(game, draw_list, alpha);
+                renderer_end_frame(renderer);
+
+                // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+                // -------------------------------------------------------------------------------
+                glfwSwapBuffers(window);
 
-                if(player_move_dir != 0)
+                // Simulate up to the present, the next frame is drawn
+                // between the last two ticks
+                size_t num_ticks = 1;
+                if(!lockstep)
                 {
-                        if(game.player.x + player_sprite.width + player_move_dir >= game.width)
-                        {
-                                game.player.x = game.width - player_sprite.width;
-                        }
-                        else if((int)game.player.x + player_move_dir <= 0)
-                        {
-                                game.player.x = 0;
-                        }
-                        else game.player.x += player_move_dir;
+                        auto now = std::chrono::steady_clock::now();
+                        num_ticks = game_clock_advance(&clock, std::chrono::duration<double>(now - frame_start).count());
+                        frame_start = now;
+                        alpha = game_clock_alpha(&clock);
                 }
 
-                // Process events
-                if(fire_pressed && game.num_bullets < GAME_MAX_BULLETS)
+                for(size_t tick = 0; tick < num_ticks; ++tick)
                 {
-                        game.bullets[game.num_bullets].x = game.player.x + player_sprite.width / 2;
-                        game.bullets[game.num_bullets].y = game.player.y + player_sprite.height;
-                        game.bullets[game.num_bullets].dir = 2;
-                        ++game.num_bullets;
+                        GameInput input;
+                        input.move_dir = move_dir;
+                        input.fire = fire_pressed;
+                        if(record_path) input_log_record(&record, game, input);
+                        game_update(game, input);
+                        fire_pressed = false;
                 }
-                fire_pressed = false;
 
                 glfwPollEvents();
         }
 
-        // glfw: terminate, clearing all previously allocated GLFW resources.
-        // ------------------------------------------------------------------
-        glfwDestroyWindow(window);
-        glfwTerminate();
-    
-        glDeleteVertexArrays(1, &fullscreen_triangle_vao);
-
-        for(size_t i = 0; i < 6; ++i)
+        double loop_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loop_start).count();
+        if(renderer->num_frames > 0 && loop_seconds > 0)
+        {
+                printf("Frames: %zu in %.2f s, %.1f per second\n", renderer->num_frames, loop_seconds,
+                       renderer->num_frames / loop_seconds);
+        }
+        if(!lockstep)
         {
-                delete[] alien_sprites[i].data;
+                printf("Ticks: %llu at %d per second, %llu dropped catching up\n",
+                       (unsigned long long)clock.ticks, GAME_TICKS_PER_SECOND,
+                       (unsigned long long)clock.dropped_ticks);
         }
 
-        delete[] text_spritesheet.data;
-        delete[] alien_death_sprite.data;
+        renderer_destroy(renderer);
+        delete renderer;
 
-        for(size_t i = 0; i < 3; ++i)
+        game_print_stats(game);
+        if(record_path)
         {
-                delete[] alien_animation[i].frames;
+                printf("Recorded %zu ticks, state hash %016llx\n", record.num_ticks,
+                       (unsigned long long)game_state_hash(game));
+                if(!input_log_write(&record, record_path)) fprintf(stderr, "Could not write %s\n", record_path);
         }
-        delete[] buffer.data;
-        delete[] game.aliens;
-        delete[] death_counters;
+        input_log_destroy(&record);
+        game_destroy(game);
+        delete game;
+
+        // glfw: terminate, clearing all previously allocated GLFW resources.
+        // ------------------------------------------------------------------
+        glfwDestroyWindow(window);
+        glfwTerminate();
 
         return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1234 @@
+#include "raster.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+// Defaults to the packing of the first upload format
+PixelFormat pixel_format = {24, 16, 8, 0};
+
+// Packs a color the way pixel_format expects it
+uint32_t rgb_to_uint32(uint8_t r, uint8_t g, uint8_t b)
+{
+        return ((uint32_t)r << pixel_format.r_shift) |
+               ((uint32_t)g << pixel_format.g_shift) |
+               ((uint32_t)b << pixel_format.b_shift) |
+               ((uint32_t)255 << pixel_format.a_shift);
+}
+
+void buffer_clear_scalar(Buffer* buffer, uint32_t color)
+{
+        for(size_t i = 0; i < buffer->width * buffer->height; ++i)
+        {
+                buffer->data[i] = color;
+        }
+}
+
+void buffer_clear(Buffer* buffer, uint32_t color)
+{
+        uint32_t* data = buffer->data;
+        size_t count = buffer->width * buffer->height;
+
+#if defined(BUFFER_SIMD_AVX2) || defined(BUFFER_SIMD_SSE2)
+        bool stream = count * sizeof(uint32_t) >= BUFFER_CLEAR_STREAM_THRESHOLD;
+
+#if defined(BUFFER_SIMD_AVX2)
+        const size_t lanes = 8;
+        const __m256i value = _mm256_set1_epi32((int)color);
+#else
+        const size_t lanes = 4;
+        const __m128i value = _mm_set1_epi32((int)color);
+#endif
+        const uintptr_t align_mask = lanes * sizeof(uint32_t) - 1;
+
+        // Scalar head until the destination is aligned to the vector width
+        while(count > 0 && ((uintptr_t)data & align_mask))
+        {
+                *data++ = color;
+                --count;
+        }
+
+        size_t num_vectors = count / lanes;
+        for(size_t i = 0; i < num_vectors; ++i)
+        {
+#if defined(BUFFER_SIMD_AVX2)
+                if(stream) _mm256_stream_si256((__m256i*)data, value);
+                else _mm256_store_si256((__m256i*)data, value);
+#else
+                if(stream) _mm_stream_si128((__m128i*)data, value);
+                else _mm_store_si128((__m128i*)data, value);
+#endif
+                data += lanes;
+        }
+        count -= num_vectors * lanes;
+
+        // Streaming stores are weakly ordered, make them visible before
+        // anything else touches the buffer.
+        if(stream) _mm_sfence();
+#endif
+
+        for(size_t i = 0; i < count; ++i)
+        {
+                data[i] = color;
+        }
+}
+
+// Times buffer_clear against the plain per-pixel loop for a few buffer sizes.
+// Run with "space_invaders --bench-clear".
+void buffer_clear_benchmark()
+{
+        static const size_t sizes[][2] = {
+                {224, 256}, {448, 512}, {896, 1024}, {1792, 2048}
+        };
+        const size_t iterations = 200;
+
+#if defined(BUFFER_SIMD_AVX2)
+        printf("buffer_clear kernel: AVX2\n");
+#elif defined(BUFFER_SIMD_SSE2)
+        printf("buffer_clear kernel: SSE2\n");
+#else
+        printf("buffer_clear kernel: scalar\n");
+#endif
+
+        for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+        {
+                Buffer buffer;
+                buffer.width  = sizes[s][0];
+                buffer.height = sizes[s][1];
+                buffer.data   = new uint32_t[buffer.width * buffer.height];
+
+                double times[2];
+                for(size_t k = 0; k < 2; ++k)
+                {
+                        auto start = std::chrono::steady_clock::now();
+                        for(size_t i = 0; i < iterations; ++i)
+                        {
+                                uint32_t color = (uint32_t)i;
+                                if(k == 0) buffer_clear_scalar(&buffer, color);
+                                else buffer_clear(&buffer, color);
+                        }
+                        auto end = std::chrono::steady_clock::now();
+                        times[k] = std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+                }
+
+                // Keep the compiler from discarding the clears
+                uint32_t checksum = buffer.data[0] + buffer.data[buffer.width * buffer.height - 1];
+
+                printf("%4zux%-4zu scalar: %8.2f us  simd: %8.2f us  speedup: %.2fx (%08x)\n",
+                       buffer.width, buffer.height, times[0], times[1],
+                       times[0] / times[1], checksum);
+
+                delete[] buffer.data;
+        }
+}
+
+bool sprite_overlap_check(
+        const Sprite& sp_a, size_t x_a, size_t y_a,
+        const Sprite& sp_b, size_t x_b, size_t y_b
+)
+{
+        // NOTE: For simplicity we just check for overlap of the sprite
+        // rectangles. Instead, if the rectangles overlap, we should
+        // further check if any pixel of sprite A overlap with any of
+        // sprite B.
+        if(x_a < x_b + sp_b.width && x_a + sp_a.width > x_b &&
+           y_a < y_b + sp_b.height && y_a + sp_a.height > y_b)
+        {
+                return true;
+        }
+
+        return false;
+}
+
+// Writes color to the pixels of one buffer row selected by mask, leaving
+// the others untouched. Each group of pixels is expanded from the mask
+// into a lane mask and blended, so there is no branch per pixel.
+inline void buffer_blend_row(uint32_t* dst, uint64_t mask, size_t num_cols, uint32_t color)
+{
+        size_t xi = 0;
+
+#if defined(BUFFER_SIMD_AVX2)
+        const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256i value = _mm256_set1_epi32((int)color);
+        for(; xi + 8 <= num_cols; xi += 8)
+        {
+                __m256i bits = _mm256_set1_epi32((int)((mask >> xi) & 0xFF));
+                __m256i lanes = _mm256_cmpeq_epi32(_mm256_and_si256(bits, lane_bits), lane_bits);
+                __m256i pixels = _mm256_loadu_si256((const __m256i*)(dst + xi));
+                pixels = _mm256_blendv_epi8(pixels, value, lanes);
+                _mm256_storeu_si256((__m256i*)(dst + xi), pixels);
+        }
+#endif
+
+#if defined(BUFFER_SIMD_AVX2) || defined(BUFFER_SIMD_SSE2)
+        const __m128i lane_bits4 = _mm_setr_epi32(1, 2, 4, 8);
+        const __m128i value4 = _mm_set1_epi32((int)color);
+        for(; xi + 4 <= num_cols; xi += 4)
+        {
+                __m128i bits = _mm_set1_epi32((int)((mask >> xi) & 0xF));
+                __m128i lanes = _mm_cmpeq_epi32(_mm_and_si128(bits, lane_bits4), lane_bits4);
+                __m128i pixels = _mm_loadu_si128((const __m128i*)(dst + xi));
+                pixels = _mm_or_si128(_mm_andnot_si128(lanes, pixels), _mm_and_si128(lanes, value4));
+                _mm_storeu_si128((__m128i*)(dst + xi), pixels);
+        }
+#endif
+
+        for(; xi < num_cols; ++xi)
+        {
+                uint32_t lane = 0u - (uint32_t)((mask >> xi) & 1);
+                dst[xi] = (dst[xi] & ~lane) | (color & lane);
+        }
+}
+
+// Draws the part of sprite that falls inside clip. clip must lie inside
+// the buffer. Returns the number of pixels of the clipped sprite rectangle.
+size_t buffer_draw_sprite_clipped(Buffer* buffer, const Sprite& sprite, size_t x, size_t y,
+                                  uint32_t color, const Rect& clip)
+{
+        // Sprite row 0 is the top row, buffer row 0 is the bottom row, so
+        // sprite row yi lands on buffer row (y + sprite.height - 1 - yi).
+        // Clip the sprite rectangle once up front.
+        if(sprite.width == 0 || sprite.height == 0) return 0;
+
+        size_t top = y + sprite.height - 1;
+        size_t clip_top = clip.y + clip.height - 1;
+        if(clip.height == 0 || top < clip.y) return 0;
+
+        size_t row_begin = top > clip_top? top - clip_top: 0;
+        size_t row_end = top - clip.y + 1;
+        if(row_end > sprite.height) row_end = sprite.height;
+        if(row_begin >= row_end) return 0;
+
+        // Start from the vector-aligned column at or left of x and use the
+        // row copy that is already shifted by the remainder.
+        size_t shift = x % SPRITE_NUM_SHIFTS;
+        size_t x_aligned = x - shift;
+
+        size_t col_begin = clip.x > x_aligned? clip.x - x_aligned: shift;
+        if(col_begin < shift) col_begin = shift;
+        size_t col_end = sprite.width + shift;
+        if(clip.x + clip.width <= x_aligned) return 0;
+        if(col_end > clip.x + clip.width - x_aligned) col_end = clip.x + clip.width - x_aligned;
+        if(col_begin >= col_end) return 0;
+
+        // Skip whole vector groups left of the clip and mask off the rest
+        size_t group_begin = col_begin - col_begin % SPRITE_NUM_SHIFTS;
+        uint64_t keep = ~(uint64_t)0 << (col_begin - group_begin);
+        size_t num_cols = col_end - group_begin;
+
+        const uint64_t* rows = sprite.rows + shift;
+        for(size_t yi = row_begin; yi < row_end; ++yi)
+        {
+                uint32_t* dst = buffer->data + (top - yi) * buffer->width + x_aligned + group_begin;
+                uint64_t mask = (rows[yi * SPRITE_NUM_SHIFTS] >> group_begin) & keep;
+                buffer_blend_row(dst, mask, num_cols, color);
+        }
+
+        return (row_end - row_begin) * (col_end - col_begin);
+}
+
+void buffer_draw_sprite(Buffer* buffer, const Sprite& sprite, size_t x, size_t y, uint32_t color)
+{
+        Rect clip = {0, 0, buffer->width, buffer->height};
+        buffer_draw_sprite_clipped(buffer, sprite, x, y, color, clip);
+}
+
+// Fills the part of the rectangle (x, y, width, height) inside clip.
+// Returns the number of pixels filled.
+size_t buffer_fill_rect_clipped(Buffer* buffer, size_t x, size_t y, size_t width, size_t height,
+                                uint32_t color, const Rect& clip)
+{
+        size_t x_begin = x > clip.x? x: clip.x;
+        size_t y_begin = y > clip.y? y: clip.y;
+        size_t x_end = x + width < clip.x + clip.width? x + width: clip.x + clip.width;
+        size_t y_end = y + height < clip.y + clip.height? y + height: clip.y + clip.height;
+        if(x_begin >= x_end || y_begin >= y_end) return 0;
+
+        for(size_t yi = y_begin; yi < y_end; ++yi)
+        {
+                uint32_t* dst = buffer->data + yi * buffer->width;
+                for(size_t xi = x_begin; xi < x_end; ++xi)
+                {
+                        dst[xi] = color;
+                }
+        }
+
+        return (x_end - x_begin) * (y_end - y_begin);
+}
+
+// Copies rect from src to dst, both must have the same size and contain
+// rect. Returns the number of pixels copied.
+size_t buffer_copy_rect(Buffer* dst, const Buffer* src, const Rect& rect)
+{
+        for(size_t yi = rect.y; yi < rect.y + rect.height; ++yi)
+        {
+                size_t offset = yi * dst->width + rect.x;
+                memcpy(dst->data + offset, src->data + offset, rect.width * sizeof(uint32_t));
+        }
+
+        return rect.width * rect.height;
+}
+
+void bit_buffer_init(BitBuffer* buffer, size_t width, size_t height)
+{
+        buffer->width = width;
+        buffer->height = height;
+        buffer->words_per_row = (width + 63) / 64;
+        buffer->data = new uint64_t[buffer->words_per_row * height];
+}
+
+void bit_buffer_destroy(BitBuffer* buffer)
+{
+        delete[] buffer->data;
+        buffer->data = 0;
+}
+
+void bit_buffer_clear(BitBuffer* buffer)
+{
+        memset(buffer->data, 0, buffer->words_per_row * buffer->height * sizeof(uint64_t));
+}
+
+// Both buffers must have the same size
+void bit_buffer_copy(BitBuffer* dst, const BitBuffer* src)
+{
+        memcpy(dst->data, src->data, src->words_per_row * src->height * sizeof(uint64_t));
+}
+
+// ORs a row mask starting at column x into a bit buffer row, or clears
+// the masked pixels if set is false. mask must not extend past the width.
+inline void bit_buffer_write_row(uint64_t* row, uint64_t mask, size_t x, bool set)
+{
+        size_t word = x / 64;
+        size_t shift = x % 64;
+        uint64_t lo = mask << shift;
+        uint64_t hi = shift? mask >> (64 - shift): 0;
+
+        if(set)
+        {
+                row[word] |= lo;
+                if(hi) row[word + 1] |= hi;
+        }
+        else
+        {
+                row[word] &= ~lo;
+                if(hi) row[word + 1] &= ~hi;
+        }
+}
+
+// Same clipping and orientation as buffer_draw_sprite
+void bit_buffer_draw_sprite(BitBuffer* buffer, const Sprite& sprite, size_t x, size_t y, bool set)
+{
+        if(x >= buffer->width || sprite.width == 0 || sprite.height == 0) return;
+
+        size_t top = y + sprite.height - 1;
+        size_t row_begin = top >= buffer->height? top - buffer->height + 1: 0;
+        if(row_begin >= sprite.height) return;
+
+        size_t num_cols = sprite.width;
+        if(num_cols > buffer->width - x) num_cols = buffer->width - x;
+        uint64_t keep = num_cols == 64? ~(uint64_t)0: ((uint64_t)1 << num_cols) - 1;
+
+        for(size_t yi = row_begin; yi < sprite.height; ++yi)
+        {
+                uint64_t* row = buffer->data + (top - yi) * buffer->words_per_row;
+                bit_buffer_write_row(row, sprite.rows[yi * SPRITE_NUM_SHIFTS] & keep, x, set);
+        }
+}
+
+void bit_buffer_fill_rect(BitBuffer* buffer, size_t x, size_t y, size_t width, size_t height, bool set)
+{
+        size_t x_end = x + width < buffer->width? x + width: buffer->width;
+        size_t y_end = y + height < buffer->height? y + height: buffer->height;
+
+        for(size_t yi = y; yi < y_end; ++yi)
+        {
+                uint64_t* row = buffer->data + yi * buffer->words_per_row;
+                for(size_t xi = x; xi < x_end; xi += 64)
+                {
+                        size_t num_cols = x_end - xi < 64? x_end - xi: 64;
+                        uint64_t mask = num_cols == 64? ~(uint64_t)0: ((uint64_t)1 << num_cols) - 1;
+                        bit_buffer_write_row(row, mask, xi, set);
+                }
+        }
+}
+
+void draw_list_init(DrawList* list, size_t capacity, size_t buffer_height)
+{
+        list->num_commands = 0;
+        list->capacity = capacity;
+        list->commands = new DrawCommand[capacity];
+        list->layer = DRAW_LAYER_BACKGROUND;
+
+        list->num_points = 0;
+        list->point_capacity = capacity;
+        list->points = new DrawPoint[capacity];
+
+        list->num_bands = (buffer_height + RASTER_BAND_HEIGHT - 1) / RASTER_BAND_HEIGHT;
+        list->num_binned = 0;
+        list->bin_capacity = capacity;
+        list->bin_offsets = new uint32_t[list->num_bands + 1];
+        list->bin_commands = new uint32_t[capacity];
+        list->point_bin_offsets = new uint32_t[list->num_bands + 1];
+        list->binned_points = new DrawPoint[capacity];
+}
+
+void draw_list_destroy(DrawList* list)
+{
+        delete[] list->commands;
+        delete[] list->points;
+        delete[] list->bin_offsets;
+        delete[] list->bin_commands;
+        delete[] list->point_bin_offsets;
+        delete[] list->binned_points;
+        list->commands = 0;
+        list->points = list->binned_points = 0;
+        list->bin_offsets = list->bin_commands = list->point_bin_offsets = 0;
+        list->num_commands = list->capacity = 0;
+        list->num_points = list->point_capacity = 0;
+}
+
+void draw_list_reset(DrawList* list)
+{
+        list->num_commands = 0;
+        list->num_points = 0;
+        list->num_binned = 0;
+        list->layer = DRAW_LAYER_BACKGROUND;
+}
+
+// Commands recorded after this call are drawn in layer
+void draw_list_set_layer(DrawList* list, uint32_t layer)
+{
+        list->layer = layer;
+}
+
+void draw_list_sprite(DrawList* list, const Sprite& sprite, size_t x, size_t y, uint32_t color)
+{
+        if(list->num_commands == list->capacity)
+        {
+                size_t capacity = 2 * list->capacity;
+                DrawCommand* commands = new DrawCommand[capacity];
+                memcpy(commands, list->commands, list->num_commands * sizeof(DrawCommand));
+                delete[] list->commands;
+                list->commands = commands;
+                list->capacity = capacity;
+        }
+
+        DrawCommand& command = list->commands[list->num_commands++];
+        command.sprite = sprite;
+        command.x = x;
+        command.y = y;
+        command.color = color;
+        command.layer = list->layer;
+}
+
+// Returns space for count more points, which the caller fills in. Points
+// must lie inside the buffer.
+DrawPoint* draw_list_reserve_points(DrawList* list, size_t count)
+{
+        if(list->num_points + count > list->point_capacity)
+        {
+                size_t capacity = 2 * (list->num_points + count);
+                DrawPoint* points = new DrawPoint[capacity];
+                memcpy(points, list->points, list->num_points * sizeof(DrawPoint));
+                delete[] list->points;
+                delete[] list->binned_points;
+                list->points = points;
+                list->binned_points = new DrawPoint[capacity];
+                list->point_capacity = capacity;
+        }
+
+        DrawPoint* points = list->points + list->num_points;
+        list->num_points += count;
+        return points;
+}
+
+void draw_list_fill_rect(DrawList* list, size_t x, size_t y, size_t width, size_t height, uint32_t color)
+{
+        Sprite rect = {width, height, 0};
+        draw_list_sprite(list, rect, x, y, color);
+}
+
+void draw_list_number(DrawList* list, const Sprite& number_spritesheet,
+                      size_t number, size_t x, size_t y, uint32_t color)
+{
+        uint8_t digits[64];
+        size_t num_digits = 0;
+
+        size_t current_number = number;
+        do
+        {
+                digits[num_digits++] = current_number % 10;
+                current_number = current_number / 10;
+        }
+        while(current_number > 0);
+
+        size_t xp = x;
+        size_t stride = number_spritesheet.height * SPRITE_NUM_SHIFTS;
+        Sprite sprite = number_spritesheet;
+        for(size_t i = 0; i < num_digits; ++i)
+        {
+                uint8_t digit = digits[num_digits - i - 1];
+                sprite.rows = number_spritesheet.rows + digit * stride;
+                draw_list_sprite(list, sprite, xp, y, color);
+                xp += sprite.width + 1;
+        }
+}
+
+void draw_list_text(DrawList* list, const Sprite& text_spritesheet,
+                    const char* text, size_t x, size_t y,
+                    uint32_t color)
+{
+        size_t xp = x;
+        size_t stride = text_spritesheet.height * SPRITE_NUM_SHIFTS;
+        Sprite sprite = text_spritesheet;
+        for(const char* charp = text; *charp != '\0'; ++charp)
+        {
+                char character = *charp - 32;
+                if(character < 0 || character >= 65) continue;
+
+                sprite.rows = text_spritesheet.rows + character * stride;
+                draw_list_sprite(list, sprite, xp, y, color);
+                xp += sprite.width + 1;
+        }
+}
+
+void text_run_cache_init(TextRunCache* cache)
+{
+        cache->frame = 0;
+        cache->hits = 0;
+        cache->misses = 0;
+        for(size_t i = 0; i < TEXT_RUN_CACHE_SIZE; ++i)
+        {
+                cache->runs[i].valid = false;
+        }
+}
+
+// Runs used in the current or the previous frame are never evicted, the
+// previous frame's draw list may still point at their rows.
+void text_run_cache_begin_frame(TextRunCache* cache)
+{
+        ++cache->frame;
+}
+
+uint32_t text_hash(const char* text)
+{
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for(const char* charp = text; *charp != '\0'; ++charp)
+        {
+                hash = (hash ^ (uint8_t)*charp) * 16777619u;
+        }
+
+        return hash;
+}
+
+// Rasterizes text into run's chunks. Returns false if the text does not
+// fit into a run.
+bool text_run_build(TextRun* run, const Sprite& text_spritesheet, const char* text)
+{
+        if(text_spritesheet.height > TEXT_RUN_MAX_HEIGHT) return false;
+
+        uint64_t masks[TEXT_RUN_MAX_CHUNKS][TEXT_RUN_MAX_HEIGHT] = {};
+        size_t chunk_widths[TEXT_RUN_MAX_CHUNKS] = {};
+        size_t num_chunks = 0;
+
+        // Same layout as draw_list_text
+        size_t xp = 0;
+        size_t stride = text_spritesheet.height * SPRITE_NUM_SHIFTS;
+        for(const char* charp = text; *charp != '\0'; ++charp)
+        {
+                char character = *charp - 32;
+                if(character < 0 || character >= 65) continue;
+
+                if(num_chunks == 0 ||
+                   xp + text_spritesheet.width - run->chunk_offsets[num_chunks - 1] > SPRITE_MAX_WIDTH)
+                {
+                        if(num_chunks == TEXT_RUN_MAX_CHUNKS) return false;
+                        run->chunk_offsets[num_chunks++] = xp;
+                }
+
+                size_t chunk = num_chunks - 1;
+                size_t offset = xp - run->chunk_offsets[chunk];
+                const uint64_t* glyph = text_spritesheet.rows + character * stride;
+                for(size_t yi = 0; yi < text_spritesheet.height; ++yi)
+                {
+                        masks[chunk][yi] |= glyph[yi * SPRITE_NUM_SHIFTS] << offset;
+                }
+                chunk_widths[chunk] = offset + text_spritesheet.width;
+
+                xp += text_spritesheet.width + 1;
+        }
+
+        run->num_chunks = num_chunks;
+        for(size_t chunk = 0; chunk < num_chunks; ++chunk)
+        {
+                uint64_t* rows = run->rows + chunk * TEXT_RUN_MAX_HEIGHT * SPRITE_NUM_SHIFTS;
+                for(size_t yi = 0; yi < text_spritesheet.height; ++yi)
+                {
+                        for(size_t shift = 0; shift < SPRITE_NUM_SHIFTS; ++shift)
+                        {
+                                rows[yi * SPRITE_NUM_SHIFTS + shift] = masks[chunk][yi] << shift;
+                        }
+                }
+
+                run->chunks[chunk].width = chunk_widths[chunk];
+                run->chunks[chunk].height = text_spritesheet.height;
+                run->chunks[chunk].rows = rows;
+        }
+
+        return true;
+}
+
+// Returns the cached run for (text, spritesheet, color), building it on a
+// miss. Returns 0 if the text cannot be cached.
+const TextRun* text_run_cache_get(TextRunCache* cache, const Sprite& text_spritesheet,
+                                  const char* text, uint32_t color)
+{
+        size_t length = strlen(text);
+        if(length >= TEXT_RUN_MAX_LENGTH) return 0;
+
+        uint32_t hash = text_hash(text);
+        TextRun* victim = 0;
+        for(size_t i = 0; i < TEXT_RUN_CACHE_SIZE; ++i)
+        {
+                TextRun* run = &cache->runs[i];
+                if(run->valid && run->hash == hash && run->color == color &&
+                   run->spritesheet == text_spritesheet.rows && strcmp(run->text, text) == 0)
+                {
+                        run->last_used = cache->frame;
+                        ++cache->hits;
+                        return run;
+                }
+
+                if(!run->valid)
+                {
+                        if(!victim || victim->valid) victim = run;
+                }
+                else if(run->last_used + 1 < cache->frame &&
+                        (!victim || (victim->valid && run->last_used < victim->last_used)))
+                {
+                        victim = run;
+                }
+        }
+
+        if(!victim) return 0;
+
+        ++cache->misses;
+        victim->valid = false;
+        if(!text_run_build(victim, text_spritesheet, text)) return 0;
+
+        memcpy(victim->text, text, length + 1);
+        victim->spritesheet = text_spritesheet.rows;
+        victim->color = color;
+        victim->hash = hash;
+        victim->valid = true;
+        victim->last_used = cache->frame;
+
+        return victim;
+}
+
+// Draws text like draw_list_text, but through the run cache
+void draw_list_text_run(DrawList* list, TextRunCache* cache, const Sprite& text_spritesheet,
+                        const char* text, size_t x, size_t y, uint32_t color)
+{
+        const TextRun* run = text_run_cache_get(cache, text_spritesheet, text, color);
+        if(!run)
+        {
+                draw_list_text(list, text_spritesheet, text, x, y, color);
+                return;
+        }
+
+        for(size_t chunk = 0; chunk < run->num_chunks; ++chunk)
+        {
+                draw_list_sprite(list, run->chunks[chunk], x + run->chunk_offsets[chunk], y, color);
+        }
+}
+
+// Total order over all fields of a command. Layers come first, then
+// commands are ordered bottom to top and left to right so a band's
+// commands touch the framebuffer roughly sequentially.
+bool draw_command_less(const DrawCommand& a, const DrawCommand& b)
+{
+        if(a.layer != b.layer) return a.layer < b.layer;
+        if(a.y != b.y) return a.y < b.y;
+        if(a.x != b.x) return a.x < b.x;
+        if(a.sprite.rows != b.sprite.rows) return a.sprite.rows < b.sprite.rows;
+        if(a.sprite.width != b.sprite.width) return a.sprite.width < b.sprite.width;
+        if(a.sprite.height != b.sprite.height) return a.sprite.height < b.sprite.height;
+        return a.color < b.color;
+}
+
+void draw_list_sort(DrawList* list)
+{
+        std::sort(list->commands, list->commands + list->num_commands, draw_command_less);
+}
+
+// Returns the raster bands [band_begin, band_end) the command overlaps
+void draw_command_bands(const DrawCommand& command, size_t num_bands,
+                        size_t* band_begin, size_t* band_end)
+{
+        size_t y_end = command.y + command.sprite.height;
+        *band_begin = command.y / RASTER_BAND_HEIGHT;
+        *band_end = (y_end + RASTER_BAND_HEIGHT - 1) / RASTER_BAND_HEIGHT;
+        if(*band_end > num_bands) *band_end = num_bands;
+        if(*band_begin > *band_end) *band_begin = *band_end;
+}
+
+// Bins the (sorted) commands by the raster bands they overlap. Each bin
+// keeps the list order.
+void draw_list_bin(DrawList* list)
+{
+        uint32_t* offsets = list->bin_offsets;
+        for(size_t band = 0; band <= list->num_bands; ++band)
+        {
+                offsets[band] = 0;
+        }
+
+        // Count the commands of each band, then turn counts into offsets
+        size_t num_binned = 0;
+        for(size_t i = 0; i < list->num_commands; ++i)
+        {
+                size_t band_begin, band_end;
+                draw_command_bands(list->commands[i], list->num_bands, &band_begin, &band_end);
+                for(size_t band = band_begin; band < band_end; ++band)
+                {
+                        ++offsets[band + 1];
+                }
+                num_binned += band_end - band_begin;
+        }
+
+        for(size_t band = 0; band < list->num_bands; ++band)
+        {
+                offsets[band + 1] += offsets[band];
+        }
+
+        if(num_binned > list->bin_capacity)
+        {
+                delete[] list->bin_commands;
+                list->bin_capacity = 2 * num_binned;
+                list->bin_commands = new uint32_t[list->bin_capacity];
+        }
+        list->num_binned = num_binned;
+
+        for(size_t i = 0; i < list->num_commands; ++i)
+        {
+                size_t band_begin, band_end;
+                draw_command_bands(list->commands[i], list->num_bands, &band_begin, &band_end);
+                for(size_t band = band_begin; band < band_end; ++band)
+                {
+                        list->bin_commands[offsets[band]++] = (uint32_t)i;
+                }
+        }
+
+        // The fill pass advanced every offset to the start of the next band
+        for(size_t band = list->num_bands; band > 0; --band)
+        {
+                offsets[band] = offsets[band - 1];
+        }
+        offsets[0] = 0;
+
+        // Points fall into exactly one band, a counting sort bins them
+        uint32_t* point_offsets = list->point_bin_offsets;
+        for(size_t band = 0; band <= list->num_bands; ++band)
+        {
+                point_offsets[band] = 0;
+        }
+        for(size_t i = 0; i < list->num_points; ++i)
+        {
+                ++point_offsets[list->points[i].y / RASTER_BAND_HEIGHT + 1];
+        }
+        for(size_t band = 0; band < list->num_bands; ++band)
+        {
+                point_offsets[band + 1] += point_offsets[band];
+        }
+        for(size_t i = 0; i < list->num_points; ++i)
+        {
+                const DrawPoint& point = list->points[i];
+                list->binned_points[point_offsets[point.y / RASTER_BAND_HEIGHT]++] = point;
+        }
+        for(size_t band = list->num_bands; band > 0; --band)
+        {
+                point_offsets[band] = point_offsets[band - 1];
+        }
+        point_offsets[0] = 0;
+}
+
+// Rasterizes the commands of the layers [layer_begin, layer_end) binned to
+// band, clipped to clip, which must lie inside the band. Returns the number
+// of pixels touched.
+size_t draw_list_execute_band(const DrawList* list, size_t band, Buffer* buffer, const Rect& clip,
+                              uint32_t layer_begin, uint32_t layer_end)
+{
+        size_t pixels = 0;
+        for(uint32_t bi = list->bin_offsets[band]; bi < list->bin_offsets[band + 1]; ++bi)
+        {
+                // Bins are sorted by layer
+                const DrawCommand& command = list->commands[list->bin_commands[bi]];
+                if(command.layer < layer_begin) continue;
+                if(command.layer >= layer_end) break;
+
+                if(command.sprite.rows)
+                {
+                        pixels += buffer_draw_sprite_clipped(buffer, command.sprite,
+                                                             command.x, command.y,
+                                                             command.color, clip);
+                }
+                else
+                {
+                        pixels += buffer_fill_rect_clipped(buffer, command.x, command.y,
+                                                           command.sprite.width, command.sprite.height,
+                                                           command.color, clip);
+                }
+        }
+
+        if(layer_begin <= DRAW_LAYER_ENTITIES && DRAW_LAYER_ENTITIES < layer_end)
+        {
+                size_t x_end = clip.x + clip.width;
+                size_t y_end = clip.y + clip.height;
+                for(uint32_t pi = list->point_bin_offsets[band]; pi < list->point_bin_offsets[band + 1]; ++pi)
+                {
+                        const DrawPoint& point = list->binned_points[pi];
+                        if(point.x < clip.x || point.x >= x_end || point.y < clip.y || point.y >= y_end) continue;
+
+                        buffer->data[point.y * buffer->width + point.x] = point.color;
+                        ++pixels;
+                }
+        }
+
+        return pixels;
+}
+
+void dirty_tracker_init(DirtyTracker* tracker, size_t buffer_width, size_t buffer_height)
+{
+        draw_list_init(&tracker->lists[0], 256, buffer_height);
+        draw_list_init(&tracker->lists[1], 256, buffer_height);
+        tracker->current = 0;
+        tracker->full_redraw = true;
+
+        tracker->row_begin = new size_t[buffer_height];
+        tracker->row_end = new size_t[buffer_height];
+        tracker->num_regions = 0;
+        tracker->regions = new Rect[buffer_height];
+
+        tracker->base.width = buffer_width;
+        tracker->base.height = buffer_height;
+        tracker->base.data = new uint32_t[buffer_width * buffer_height];
+        bit_buffer_init(&tracker->base_bits, buffer_width, buffer_height);
+        tracker->base_row_begin = new size_t[buffer_height];
+        tracker->base_row_end = new size_t[buffer_height];
+        tracker->num_base_regions = 0;
+        tracker->base_regions = new Rect[buffer_height];
+
+        tracker->num_frames = 0;
+        tracker->pixels_touched = 0;
+        tracker->base_pixels_touched = 0;
+        tracker->bytes_uploaded = 0;
+        tracker->commands_recorded = 0;
+        tracker->commands_binned = 0;
+        tracker->points_recorded = 0;
+        tracker->raster_seconds = 0;
+}
+
+void dirty_tracker_destroy(DirtyTracker* tracker)
+{
+        draw_list_destroy(&tracker->lists[0]);
+        draw_list_destroy(&tracker->lists[1]);
+        delete[] tracker->row_begin;
+        delete[] tracker->row_end;
+        delete[] tracker->regions;
+
+        delete[] tracker->base.data;
+        bit_buffer_destroy(&tracker->base_bits);
+        delete[] tracker->base_row_begin;
+        delete[] tracker->base_row_end;
+        delete[] tracker->base_regions;
+}
+
+// Returns the empty list the next frame should be recorded into
+DrawList* dirty_tracker_begin_frame(DirtyTracker* tracker)
+{
+        tracker->current ^= 1;
+        DrawList* list = &tracker->lists[tracker->current];
+        draw_list_reset(list);
+        return list;
+}
+
+// Widens the per-row dirty spans to cover command
+void dirty_spans_mark(size_t* row_begin, size_t* row_end, const Buffer* buffer, const DrawCommand& command)
+{
+        // Same clipping as the rasterizer, but for the whole sprite rectangle
+        size_t x_begin = command.x;
+        size_t y_begin = command.y;
+        size_t x_end = command.x + command.sprite.width;
+        size_t y_end = command.y + command.sprite.height;
+        if(x_end > buffer->width) x_end = buffer->width;
+        if(y_end > buffer->height) y_end = buffer->height;
+
+        for(size_t yi = y_begin; yi < y_end; ++yi)
+        {
+                if(x_begin < row_begin[yi]) row_begin[yi] = x_begin;
+                if(x_end > row_end[yi]) row_end[yi] = x_end;
+        }
+}
+
+// Merges consecutive dirty rows into bands. Returns the number of regions
+// written, at most one per row.
+size_t dirty_spans_merge(const size_t* row_begin, const size_t* row_end, size_t height, Rect* regions)
+{
+        size_t num_regions = 0;
+        for(size_t yi = 0; yi < height;)
+        {
+                if(row_begin[yi] >= row_end[yi])
+                {
+                        ++yi;
+                        continue;
+                }
+
+                Rect& region = regions[num_regions++];
+                size_t x_begin = row_begin[yi];
+                size_t x_end = row_end[yi];
+                size_t y_begin = yi;
+                for(; yi < height && row_begin[yi] < row_end[yi]; ++yi)
+                {
+                        if(row_begin[yi] < x_begin) x_begin = row_begin[yi];
+                        if(row_end[yi] > x_end) x_end = row_end[yi];
+                }
+
+                region.x = x_begin;
+                region.y = y_begin;
+                region.width = x_end - x_begin;
+                region.height = yi - y_begin;
+        }
+
+        return num_regions;
+}
+
+// A changed command dirties the frame, and the base image too if it is
+// on a static layer
+void dirty_tracker_mark(DirtyTracker* tracker, const Buffer* buffer, const DrawCommand& command)
+{
+        dirty_spans_mark(tracker->row_begin, tracker->row_end, buffer, command);
+        if(command.layer < DRAW_LAYER_ENTITIES)
+        {
+                dirty_spans_mark(tracker->base_row_begin, tracker->base_row_end, buffer, command);
+        }
+}
+
+// Rasterizes the commands of the layers [layer_begin, layer_end) of a
+// sorted list into a bit buffer. Commands drawn in clear_color clear their
+// pixels, everything else sets them; the actual colors are applied by the
+// overlay when the plane is displayed.
+void bit_buffer_execute(BitBuffer* buffer, const DrawList* list, uint32_t clear_color,
+                        uint32_t layer_begin, uint32_t layer_end)
+{
+        for(size_t i = 0; i < list->num_commands; ++i)
+        {
+                const DrawCommand& command = list->commands[i];
+                if(command.layer < layer_begin) continue;
+                if(command.layer >= layer_end) break;
+
+                bool set = command.color != clear_color;
+                if(command.sprite.rows)
+                {
+                        bit_buffer_draw_sprite(buffer, command.sprite, command.x, command.y, set);
+                }
+                else
+                {
+                        bit_buffer_fill_rect(buffer, command.x, command.y,
+                                             command.sprite.width, command.sprite.height, set);
+                }
+        }
+
+        if(layer_begin <= DRAW_LAYER_ENTITIES && DRAW_LAYER_ENTITIES < layer_end)
+        {
+                for(size_t i = 0; i < list->num_points; ++i)
+                {
+                        const DrawPoint& point = list->points[i];
+                        uint64_t* word = buffer->data + point.y * buffer->words_per_row + point.x / 64;
+                        uint64_t bit = (uint64_t)1 << (point.x % 64);
+                        *word = point.color != clear_color? *word | bit: *word & ~bit;
+                }
+        }
+}
+
+// Restores the part of every region that falls inside band, by clearing
+// it or, if base is not null, copying it from base, then redraws the
+// layers [layer_begin, layer_end) over it. Returns the number of pixels touched.
+size_t raster_band(const DrawList* list, Buffer* buffer, const Rect* regions, size_t num_regions,
+                   uint32_t clear_color, const Buffer* base, uint32_t layer_begin, uint32_t layer_end,
+                   size_t band)
+{
+        size_t band_begin = band * RASTER_BAND_HEIGHT;
+        size_t band_end = band_begin + RASTER_BAND_HEIGHT;
+        if(band_end > buffer->height) band_end = buffer->height;
+
+        size_t pixels = 0;
+        for(size_t ri = 0; ri < num_regions; ++ri)
+        {
+                const Rect& region = regions[ri];
+                size_t y_begin = region.y > band_begin? region.y: band_begin;
+                size_t y_end = region.y + region.height < band_end? region.y + region.height: band_end;
+                if(y_begin >= y_end) continue;
+
+                Rect clip = {region.x, y_begin, region.width, y_end - y_begin};
+                if(base)
+                {
+                        pixels += buffer_copy_rect(buffer, base, clip);
+                }
+                else
+                {
+                        pixels += buffer_fill_rect_clipped(buffer, clip.x, clip.y, clip.width, clip.height,
+                                                           clear_color, clip);
+                }
+                pixels += draw_list_execute_band(list, band, buffer, clip, layer_begin, layer_end);
+        }
+
+        return pixels;
+}
+
+size_t raster_job_run_band(void* job, size_t band)
+{
+        const RasterJob* raster = (const RasterJob*)job;
+        return raster_band(raster->list, raster->buffer, raster->regions, raster->num_regions,
+                           raster->clear_color, raster->base, raster->layer_begin, raster->layer_end,
+                           band);
+}
+
+void worker_pool_run_items(WorkerPool* pool)
+{
+        size_t result = 0;
+        for(;;)
+        {
+                size_t item = pool->next_item.fetch_add(1);
+                if(item >= pool->num_items) break;
+
+                result += pool->run_item(pool->job, item);
+        }
+
+        pool->result += result;
+}
+
+void worker_pool_worker(WorkerPool* pool)
+{
+        size_t generation = 0;
+        for(;;)
+        {
+                {
+                        std::unique_lock<std::mutex> lock(pool->mutex);
+                        pool->work_ready.wait(lock, [&]{ return pool->quit || pool->generation != generation; });
+                        if(pool->quit) return;
+                        generation = pool->generation;
+                }
+
+                worker_pool_run_items(pool);
+
+                {
+                        std::lock_guard<std::mutex> lock(pool->mutex);
+                        ++pool->num_workers_done;
+                }
+                pool->work_done.notify_one();
+        }
+}
+
+void worker_pool_init(WorkerPool* pool, size_t num_workers)
+{
+        pool->num_workers = num_workers;
+        pool->generation = 0;
+        pool->num_workers_done = 0;
+        pool->quit = false;
+        pool->workers = num_workers? new std::thread[num_workers]: 0;
+        for(size_t i = 0; i < num_workers; ++i)
+        {
+                pool->workers[i] = std::thread(worker_pool_worker, pool);
+        }
+}
+
+void worker_pool_destroy(WorkerPool* pool)
+{
+        {
+                std::lock_guard<std::mutex> lock(pool->mutex);
+                pool->quit = true;
+        }
+        pool->work_ready.notify_all();
+
+        for(size_t i = 0; i < pool->num_workers; ++i)
+        {
+                pool->workers[i].join();
+        }
+        delete[] pool->workers;
+        pool->workers = 0;
+        pool->num_workers = 0;
+}
+
+// Runs run_item(job, item) for every item in [0, num_items) and returns
+// the sum of the results. Items may run concurrently and in any order.
+size_t worker_pool_execute(WorkerPool* pool, WorkerPoolItemFunc run_item, void* job, size_t num_items)
+{
+        if(num_items == 0) return 0;
+
+        pool->run_item = run_item;
+        pool->job = job;
+        pool->num_items = num_items;
+        pool->next_item = 0;
+        pool->result = 0;
+
+        if(pool->num_workers == 0 || num_items == 1)
+        {
+                worker_pool_run_items(pool);
+                return pool->result;
+        }
+
+        {
+                std::lock_guard<std::mutex> lock(pool->mutex);
+                pool->num_workers_done = 0;
+                ++pool->generation;
+        }
+        pool->work_ready.notify_all();
+
+        worker_pool_run_items(pool);
+
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        pool->work_done.wait(lock, [&]{ return pool->num_workers_done == pool->num_workers; });
+
+        return pool->result;
+}
+
+// Restores the regions, see raster_band, and redraws the layers
+// [layer_begin, layer_end) of list over them, one raster band per pool
+// item. Returns the number of pixels touched.
+size_t raster_execute(WorkerPool* pool, const DrawList* list, Buffer* buffer,
+                      const Rect* regions, size_t num_regions, uint32_t clear_color,
+                      const Buffer* base, uint32_t layer_begin, uint32_t layer_end)
+{
+        if(num_regions == 0) return 0;
+
+        RasterJob job = {list, buffer, regions, num_regions, clear_color, base, layer_begin, layer_end};
+        size_t num_bands = (buffer->height + RASTER_BAND_HEIGHT - 1) / RASTER_BAND_HEIGHT;
+        return worker_pool_execute(pool, raster_job_run_band, &job, num_bands);
+}
+
+// Diffs the recorded frame against the previous one, then updates the
+// changed parts of the base image and of buffer through pool. The merged
+// dirty regions that need to be uploaded are left in tracker->regions.
+void dirty_tracker_end_frame(DirtyTracker* tracker, Buffer* buffer, uint32_t clear_color, WorkerPool* pool)
+{
+        DrawList* current = &tracker->lists[tracker->current];
+        const DrawList* previous = &tracker->lists[tracker->current ^ 1];
+
+        auto raster_start = std::chrono::steady_clock::now();
+        draw_list_sort(current);
+
+        for(size_t yi = 0; yi < buffer->height; ++yi)
+        {
+                tracker->row_begin[yi] = tracker->full_redraw? 0: buffer->width;
+                tracker->row_end[yi] = tracker->full_redraw? buffer->width: 0;
+                tracker->base_row_begin[yi] = tracker->row_begin[yi];
+                tracker->base_row_end[yi] = tracker->row_end[yi];
+        }
+        tracker->full_redraw = false;
+
+        // Both lists are sorted, so a merge pairs up the commands present in
+        // both frames and marks the rest. A pixel that is not covered by any
+        // unpaired command sees the same commands in both frames, in an order
+        // that only differs within a layer, so it cannot have changed.
+        size_t ci = 0, pi = 0;
+        while(ci < current->num_commands || pi < previous->num_commands)
+        {
+                if(pi == previous->num_commands ||
+                   (ci < current->num_commands &&
+                    draw_command_less(current->commands[ci], previous->commands[pi])))
+                {
+                        dirty_tracker_mark(tracker, buffer, current->commands[ci++]);
+                }
+                else if(ci == current->num_commands ||
+                        draw_command_less(previous->commands[pi], current->commands[ci]))
+                {
+                        dirty_tracker_mark(tracker, buffer, previous->commands[pi++]);
+                }
+                else
+                {
+                        ++ci;
+                        ++pi;
+                }
+        }
+
+        // Points are not paired up, the old and new ones are all dirty
+        const DrawList* lists[2] = {current, previous};
+        for(size_t li = 0; li < 2; ++li)
+        {
+                for(size_t i = 0; i < lists[li]->num_points; ++i)
+                {
+                        const DrawPoint& point = lists[li]->points[i];
+                        if(point.x < tracker->row_begin[point.y]) tracker->row_begin[point.y] = point.x;
+                        if(point.x + 1u > tracker->row_end[point.y]) tracker->row_end[point.y] = point.x + 1u;
+                }
+        }
+
+        tracker->num_regions = dirty_spans_merge(tracker->row_begin, tracker->row_end,
+                                                 buffer->height, tracker->regions);
+        tracker->num_base_regions = dirty_spans_merge(tracker->base_row_begin, tracker->base_row_end,
+                                                      buffer->height, tracker->base_regions);
+
+        // Bring the base image up to date first, the frame's dirty regions
+        // are then copied from it and only get the entity layer drawn over them
+        draw_list_bin(current);
+        tracker->base_pixels_touched += raster_execute(pool, current, &tracker->base,
+                                                       tracker->base_regions, tracker->num_base_regions,
+                                                       clear_color, 0,
+                                                       DRAW_LAYER_BACKGROUND, DRAW_LAYER_ENTITIES);
+        tracker->pixels_touched += raster_execute(pool, current, buffer,
+                                                  tracker->regions, tracker->num_regions,
+                                                  clear_color, &tracker->base,
+                                                  DRAW_LAYER_ENTITIES, DRAW_NUM_LAYERS);
+        for(size_t ri = 0; ri < tracker->num_regions; ++ri)
+        {
+                const Rect& region = tracker->regions[ri];
+                tracker->bytes_uploaded += region.width * region.height * sizeof(uint32_t);
+        }
+
+        tracker->commands_recorded += current->num_commands;
+        tracker->commands_binned += current->num_binned;
+        tracker->points_recorded += current->num_points;
+        tracker->raster_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - raster_start).count();
+
+        ++tracker->num_frames;
+}
+
+// 1bpp version of dirty_tracker_end_frame. The plane is rebuilt every
+// frame, but from a copy of the base plane, which is only re-rasterized
+// when a command on a static layer changed.
+void dirty_tracker_end_frame_bits(DirtyTracker* tracker, BitBuffer* buffer, uint32_t clear_color)
+{
+        DrawList* current = &tracker->lists[tracker->current];
+        const DrawList* previous = &tracker->lists[tracker->current ^ 1];
+        draw_list_sort(current);
+
+        // Both lists are sorted by layer first, so their static commands
+        // are prefixes that can be compared directly
+        bool rebuild = tracker->full_redraw;
+        for(size_t i = 0; !rebuild; ++i)
+        {
+                bool current_static = i < current->num_commands &&
+                                      current->commands[i].layer < DRAW_LAYER_ENTITIES;
+                bool previous_static = i < previous->num_commands &&
+                                       previous->commands[i].layer < DRAW_LAYER_ENTITIES;
+                if(!current_static && !previous_static) break;
+
+                rebuild = current_static != previous_static ||
+                          draw_command_less(current->commands[i], previous->commands[i]) ||
+                          draw_command_less(previous->commands[i], current->commands[i]);
+        }
+        tracker->full_redraw = false;
+
+        if(rebuild)
+        {
+                bit_buffer_clear(&tracker->base_bits);
+                bit_buffer_execute(&tracker->base_bits, current, clear_color,
+                                   DRAW_LAYER_BACKGROUND, DRAW_LAYER_ENTITIES);
+                tracker->base_pixels_touched += buffer->width * buffer->height;
+        }
+
+        bit_buffer_copy(buffer, &tracker->base_bits);
+        bit_buffer_execute(buffer, current, clear_color, DRAW_LAYER_ENTITIES, DRAW_NUM_LAYERS);
+}
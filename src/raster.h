@@ -0,0 +1,302 @@
+#ifndef SPACE_INVADERS_RASTER_H
+#define SPACE_INVADERS_RASTER_H
+
+// Software rasterizer: pixel buffers, sprites, the per-frame draw list and
+// the dirty-region tracker that rasterizes it. Window and GL free, shared
+// by every front end.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BUFFER_SIMD_AVX2
+#define BUFFER_SIMD_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BUFFER_SIMD_SSE2
+#define BUFFER_SIMD_LANES 4
+#else
+#define BUFFER_SIMD_LANES 1
+#endif
+
+// Buffers at least this big (in bytes) are cleared with non-temporal stores
+// so the clear does not evict the rest of the working set from the cache.
+#define BUFFER_CLEAR_STREAM_THRESHOLD (1024 * 1024)
+
+struct Buffer
+{
+        size_t width, height;
+        uint32_t* data;
+};
+
+// One bit per pixel plane, bit (xi % 64) of word (xi / 64) of a row is the
+// pixel in column xi. Rows are padded to whole words. On little-endian
+// hosts the words are also a valid byte-per-8-pixels image, which is how
+// the plane is uploaded.
+struct BitBuffer
+{
+        size_t width, height;
+        size_t words_per_row;
+        uint64_t* data;
+};
+
+// Rectangle in buffer coordinates, row 0 is the bottom row
+struct Rect
+{
+        size_t x, y;
+        size_t width, height;
+};
+
+// Sprites are stored as 1-bit masks, one word per row. Bit xi of a row is
+// the pixel in column xi. Every row is stored SPRITE_NUM_SHIFTS times,
+// pre-shifted left by 0..SPRITE_NUM_SHIFTS-1 columns, so a sprite at any x
+// can be blitted starting from a vector-aligned column without shifting
+// rows at draw time. The shifted copies of a row are stored next to each
+// other: rows[yi * SPRITE_NUM_SHIFTS + shift].
+#define SPRITE_NUM_SHIFTS BUFFER_SIMD_LANES
+#define SPRITE_MAX_WIDTH (65 - SPRITE_NUM_SHIFTS)
+struct Sprite
+{
+        size_t width, height;
+        const uint64_t* rows;
+};
+
+// Height in rows of the horizontal bands the rasterizer splits the buffer
+// into. Bands span the whole buffer width, so two bands never share a
+// pixel, not even through the vector groups buffer_blend_row rewrites.
+#define RASTER_BAND_HEIGHT 16
+
+// Draw commands are executed layer by layer. Within a layer they are
+// sorted for locality, so commands of one layer must not depend on the
+// order they are drawn in (overlapping draws must have the same color).
+// The layers below DRAW_LAYER_ENTITIES are the static layers: they are
+// composited into a cached base image instead of being redrawn per frame.
+enum DrawLayer: uint32_t
+{
+        DRAW_LAYER_BACKGROUND = 0,
+        DRAW_LAYER_HUD        = 1,
+        DRAW_LAYER_ENTITIES   = 2,
+        DRAW_NUM_LAYERS       = 3
+};
+
+// A recorded draw. Commands with sprite.rows == 0 fill the whole
+// sprite rectangle with color.
+struct DrawCommand
+{
+        Sprite sprite;
+        size_t x, y;
+        uint32_t color;
+        uint32_t layer;
+};
+
+// A single pixel. Points belong to the entity layer and are drawn after
+// its commands; like them they must not depend on the order they are drawn in.
+struct DrawPoint
+{
+        uint16_t x, y;
+        uint32_t color;
+};
+
+// Per-frame command buffer. Commands are recorded in any order, then
+// sorted and binned by raster band, bin_offsets[band] .. bin_offsets[band + 1]
+// index the commands in bin_commands that overlap the band. Points are
+// binned by copying them into binned_points in band order, the points of
+// a band are point_bin_offsets[band] .. point_bin_offsets[band + 1].
+struct DrawList
+{
+        size_t num_commands;
+        size_t capacity;
+        DrawCommand* commands;
+        uint32_t layer;
+
+        size_t num_points;
+        size_t point_capacity;
+        DrawPoint* points;
+
+        size_t num_bands;
+        size_t num_binned;
+        size_t bin_capacity;
+        uint32_t* bin_offsets;
+        uint32_t* bin_commands;
+        uint32_t* point_bin_offsets;
+        DrawPoint* binned_points;
+};
+
+// A string pre-rasterized into packed sprite chunks, so it can be drawn
+// with one command per chunk instead of one per glyph. Chunks are cut at
+// glyph boundaries to stay within SPRITE_MAX_WIDTH.
+#define TEXT_RUN_MAX_LENGTH 32
+#define TEXT_RUN_MAX_HEIGHT 8
+#define TEXT_RUN_MAX_CHUNKS 4
+struct TextRun
+{
+        // Cache key
+        char text[TEXT_RUN_MAX_LENGTH];
+        const uint64_t* spritesheet;
+        uint32_t color;
+        uint32_t hash;
+
+        bool valid;
+        size_t last_used;
+
+        size_t num_chunks;
+        size_t chunk_offsets[TEXT_RUN_MAX_CHUNKS];
+        Sprite chunks[TEXT_RUN_MAX_CHUNKS];
+        uint64_t rows[TEXT_RUN_MAX_CHUNKS * TEXT_RUN_MAX_HEIGHT * SPRITE_NUM_SHIFTS];
+};
+
+#define TEXT_RUN_CACHE_SIZE 16
+struct TextRunCache
+{
+        size_t frame;
+        uint64_t hits;
+        uint64_t misses;
+        TextRun runs[TEXT_RUN_CACHE_SIZE];
+};
+
+// Tracks which parts of the buffer change between frames. The frame is
+// recorded into a DrawList, compared against the previous frame's list
+// and only the rows/columns touched by changed commands are restored,
+// redrawn and uploaded.
+//
+// The static layers are rasterized over the clear color into a base
+// image that is kept across frames and only redrawn where their commands
+// change, which for the background is never after the first frame.
+// Dirty regions of the frame are restored by copying from the base image,
+// so only the entity layer is drawn per frame.
+struct DirtyTracker
+{
+        DrawList lists[2];
+        size_t current;
+        bool full_redraw;
+
+        // Per-row dirty span [row_begin, row_end) for the current frame
+        size_t* row_begin;
+        size_t* row_end;
+
+        // Dirty spans merged into row bands, at most one per buffer row
+        size_t num_regions;
+        Rect* regions;
+
+        // Base image of the static layers and its dirty spans/regions
+        Buffer base;
+        BitBuffer base_bits;
+        size_t* base_row_begin;
+        size_t* base_row_end;
+        size_t num_base_regions;
+        Rect* base_regions;
+
+        // Counters, accumulated over all frames
+        size_t num_frames;
+        uint64_t pixels_touched;
+        uint64_t base_pixels_touched;
+        uint64_t bytes_uploaded;
+        uint64_t commands_recorded;
+        uint64_t commands_binned;
+        uint64_t points_recorded;
+        double raster_seconds;
+};
+
+// Runs the items of a job in parallel on a set of worker threads and the
+// calling thread, which pick up items one at a time. Used to rasterize the
+// bands of a frame and to update particles in chunks.
+typedef size_t (*WorkerPoolItemFunc)(void* job, size_t item);
+struct WorkerPool
+{
+        size_t num_workers;
+        std::thread* workers;
+
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::condition_variable work_done;
+        size_t generation;
+        size_t num_workers_done;
+        bool quit;
+
+        // Current job, the results of its items are summed
+        WorkerPoolItemFunc run_item;
+        void* job;
+        size_t num_items;
+        std::atomic<size_t> next_item;
+        std::atomic<size_t> result;
+};
+
+// Dirty regions of a frame to restore and redraw, see raster_band
+struct RasterJob
+{
+        const DrawList* list;
+        Buffer* buffer;
+        const Rect* regions;
+        size_t num_regions;
+        uint32_t clear_color;
+        const Buffer* base;
+        uint32_t layer_begin, layer_end;
+};
+
+// Bit position of each channel in a packed uint32_t pixel. Front ends set
+// this to the packing they present buffers in before recording frames.
+struct PixelFormat
+{
+        uint8_t r_shift, g_shift, b_shift, a_shift;
+};
+
+extern PixelFormat pixel_format;
+
+uint32_t rgb_to_uint32(uint8_t r, uint8_t g, uint8_t b);
+
+void buffer_clear(Buffer* buffer, uint32_t color);
+void buffer_clear_benchmark();
+void buffer_draw_sprite(Buffer* buffer, const Sprite& sprite, size_t x, size_t y, uint32_t color);
+size_t buffer_copy_rect(Buffer* dst, const Buffer* src, const Rect& rect);
+
+bool sprite_overlap_check(
+        const Sprite& sp_a, size_t x_a, size_t y_a,
+        const Sprite& sp_b, size_t x_b, size_t y_b
+);
+
+void bit_buffer_init(BitBuffer* buffer, size_t width, size_t height);
+void bit_buffer_destroy(BitBuffer* buffer);
+void bit_buffer_clear(BitBuffer* buffer);
+void bit_buffer_copy(BitBuffer* dst, const BitBuffer* src);
+void bit_buffer_draw_sprite(BitBuffer* buffer, const Sprite& sprite, size_t x, size_t y, bool set);
+
+void draw_list_init(DrawList* list, size_t capacity, size_t buffer_height);
+void draw_list_destroy(DrawList* list);
+void draw_list_reset(DrawList* list);
+void draw_list_set_layer(DrawList* list, uint32_t layer);
+void draw_list_sprite(DrawList* list, const Sprite& sprite, size_t x, size_t y, uint32_t color);
+DrawPoint* draw_list_reserve_points(DrawList* list, size_t count);
+void draw_list_fill_rect(DrawList* list, size_t x, size_t y, size_t width, size_t height, uint32_t color);
+void draw_list_number(DrawList* list, const Sprite& number_spritesheet,
+                      size_t number, size_t x, size_t y, uint32_t color);
+void draw_list_text(DrawList* list, const Sprite& text_spritesheet,
+                    const char* text, size_t x, size_t y,
+                    uint32_t color);
+void draw_list_text_run(DrawList* list, TextRunCache* cache, const Sprite& text_spritesheet,
+                        const char* text, size_t x, size_t y, uint32_t color);
+void draw_list_sort(DrawList* list);
+void draw_list_bin(DrawList* list);
+
+void text_run_cache_init(TextRunCache* cache);
+void text_run_cache_begin_frame(TextRunCache* cache);
+
+void dirty_tracker_init(DirtyTracker* tracker, size_t buffer_width, size_t buffer_height);
+void dirty_tracker_destroy(DirtyTracker* tracker);
+DrawList* dirty_tracker_begin_frame(DirtyTracker* tracker);
+void dirty_tracker_end_frame(DirtyTracker* tracker, Buffer* buffer, uint32_t clear_color, WorkerPool* pool);
+void dirty_tracker_end_frame_bits(DirtyTracker* tracker, BitBuffer* buffer, uint32_t clear_color);
+
+void worker_pool_init(WorkerPool* pool, size_t num_workers);
+void worker_pool_destroy(WorkerPool* pool);
+size_t worker_pool_execute(WorkerPool* pool, WorkerPoolItemFunc run_item, void* job, size_t num_items);
+
+size_t raster_execute(WorkerPool* pool, const DrawList* list, Buffer* buffer,
+                      const Rect* regions, size_t num_regions, uint32_t clear_color,
+                      const Buffer* base, uint32_t layer_begin, uint32_t layer_end);
+
+#endif
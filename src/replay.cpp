@@ -0,0 +1,237 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void input_log_init(InputLog* log, const GameConfig& config, size_t keyframe_interval)
+{
+        log->width = config.width;
+        log->height = config.height;
+        log->particle_stress = config.particle_stress;
+        log->bullet_stress = config.bullet_stress;
+
+        log->num_ticks = 0;
+        log->capacity = 4096;
+        log->inputs = new uint8_t[log->capacity];
+
+        log->keyframe_interval = keyframe_interval;
+        log->num_keyframes = 0;
+        log->keyframe_capacity = 16;
+        log->keyframes = new ReplayKeyframe[log->keyframe_capacity];
+        log->keyframe_data_size = 0;
+        log->keyframe_data_capacity = 1 << 16;
+        log->keyframe_data = new uint8_t[log->keyframe_data_capacity];
+}
+
+void input_log_destroy(InputLog* log)
+{
+        delete[] log->inputs;
+        delete[] log->keyframes;
+        delete[] log->keyframe_data;
+        log->inputs = 0;
+        log->keyframes = 0;
+        log->keyframe_data = 0;
+        log->num_ticks = log->capacity = 0;
+        log->num_keyframes = log->keyframe_capacity = 0;
+        log->keyframe_data_size = log->keyframe_data_capacity = 0;
+}
+
+// Saves the state of game as the keyframe of the next tick
+void input_log_add_keyframe(InputLog* log, const Game* game)
+{
+        if(log->num_keyframes == log->keyframe_capacity)
+        {
+                ReplayKeyframe* keyframes = new ReplayKeyframe[2 * log->keyframe_capacity];
+                memcpy(keyframes, log->keyframes, log->num_keyframes * sizeof(ReplayKeyframe));
+                delete[] log->keyframes;
+                log->keyframes = keyframes;
+                log->keyframe_capacity *= 2;
+        }
+
+        size_t size = game_state_size(game);
+        if(log->keyframe_data_size + size > log->keyframe_data_capacity)
+        {
+                size_t capacity = 2 * log->keyframe_data_capacity;
+                while(log->keyframe_data_size + size > capacity) capacity *= 2;
+                uint8_t* data = new uint8_t[capacity];
+                memcpy(data, log->keyframe_data, log->keyframe_data_size);
+                delete[] log->keyframe_data;
+                log->keyframe_data = data;
+                log->keyframe_data_capacity = capacity;
+        }
+
+        ReplayKeyframe& keyframe = log->keyframes[log->num_keyframes++];
+        keyframe.tick = log->num_ticks;
+        keyframe.offset = log->keyframe_data_size;
+        keyframe.size = size;
+        game_save_state(game, log->keyframe_data + log->keyframe_data_size);
+        log->keyframe_data_size += size;
+}
+
+// Appends the input of the next tick, game is the state before the tick
+void input_log_record(InputLog* log, const Game* game, const GameInput& input)
+{
+        if(log->keyframe_interval > 0 && log->num_ticks % log->keyframe_interval == 0)
+        {
+                input_log_add_keyframe(log, game);
+        }
+
+        if(log->num_ticks == log->capacity)
+        {
+                uint8_t* inputs = new uint8_t[2 * log->capacity];
+                memcpy(inputs, log->inputs, log->num_ticks);
+                delete[] log->inputs;
+                log->inputs = inputs;
+                log->capacity *= 2;
+        }
+
+        uint8_t bits = 0;
+        if(input.move_dir < 0) bits |= INPUT_MOVE_LEFT;
+        if(input.move_dir > 0) bits |= INPUT_MOVE_RIGHT;
+        if(input.fire) bits |= INPUT_FIRE;
+        log->inputs[log->num_ticks++] = bits;
+}
+
+// Input of tick, no input past the end of the log
+GameInput input_log_input(const InputLog* log, size_t tick)
+{
+        uint8_t bits = tick < log->num_ticks? log->inputs[tick]: 0;
+
+        GameInput input;
+        input.move_dir = (bits & INPUT_MOVE_RIGHT? 1: 0) - (bits & INPUT_MOVE_LEFT? 1: 0);
+        input.fire = (bits & INPUT_FIRE) != 0;
+        return input;
+}
+
+// Brings game, initialized with the config of the log, to the state
+// before tick: loads the last keyframe at or before tick and simulates
+// the rest. Without a keyframe the game has to be in its initial state.
+// Returns false, with game untouched, if the keyframe is malformed.
+bool input_log_seek(const InputLog* log, Game* game, size_t tick, size_t* num_simulated)
+{
+        // Last keyframe at or before tick, the keyframes are in tick order
+        size_t begin = 0, end = log->num_keyframes;
+        while(begin < end)
+        {
+                size_t mid = begin + (end - begin) / 2;
+                if(log->keyframes[mid].tick <= tick) begin = mid + 1;
+                else end = mid;
+        }
+
+        size_t start_tick = 0;
+        if(begin > 0)
+        {
+                const ReplayKeyframe& keyframe = log->keyframes[begin - 1];
+                if(!game_load_state(game, log->keyframe_data + keyframe.offset, keyframe.size)) return false;
+                start_tick = keyframe.tick;
+        }
+
+        for(size_t t = start_tick; t < tick; ++t) game_update(game, input_log_input(log, t));
+        *num_simulated = tick - start_tick;
+        return true;
+}
+
+// Overrides the fields of config the recorded session depends on
+void input_log_apply_config(const InputLog* log, GameConfig* config)
+{
+        config->width = log->width;
+        config->height = log->height;
+        config->particle_stress = log->particle_stress;
+        config->bullet_stress = log->bullet_stress;
+}
+
+bool input_log_write(const InputLog* log, const char* path)
+{
+        FILE* file = fopen(path, "wb");
+        if(!file) return false;
+
+        ReplayHeader header;
+        header.magic = REPLAY_MAGIC;
+        header.version = REPLAY_VERSION;
+        header.width = (uint32_t)log->width;
+        header.height = (uint32_t)log->height;
+        header.particle_stress = (uint32_t)log->particle_stress;
+        header.bullet_stress = (uint32_t)log->bullet_stress;
+        header.keyframe_interval = (uint32_t)log->keyframe_interval;
+        header.num_keyframes = (uint32_t)log->num_keyframes;
+        header.num_ticks = log->num_ticks;
+        header.keyframe_data_size = log->keyframe_data_size;
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(log->inputs, 1, log->num_ticks, file) == log->num_ticks &&
+                  fwrite(log->keyframes, sizeof(ReplayKeyframe), log->num_keyframes, file) == log->num_keyframes &&
+                  fwrite(log->keyframe_data, 1, log->keyframe_data_size, file) == log->keyframe_data_size;
+        return fclose(file) == 0 && ok;
+}
+
+// Replaces the contents of an initialized log with the file at path
+bool input_log_read(InputLog* log, const char* path)
+{
+        FILE* file = fopen(path, "rb");
+        if(!file) return false;
+
+        ReplayHeader header;
+        if(fread(&header, sizeof(header), 1, file) != 1 ||
+           header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION)
+        {
+                fclose(file);
+                return false;
+        }
+
+        // The sections have to fill the rest of the file exactly, before
+        // anything is allocated for them
+        long data_begin = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long file_size = ftell(file);
+        fseek(file, data_begin, SEEK_SET);
+        uint64_t data_size = data_begin >= 0 && file_size >= data_begin? (uint64_t)(file_size - data_begin): 0;
+        if(header.num_ticks > data_size || header.keyframe_data_size > data_size ||
+           header.num_keyframes > data_size / sizeof(ReplayKeyframe) ||
+           header.num_ticks + header.num_keyframes * sizeof(ReplayKeyframe) + header.keyframe_data_size != data_size)
+        {
+                fclose(file);
+                return false;
+        }
+
+        // One extra entry each, so empty sections still allocate
+        uint8_t* inputs = new uint8_t[header.num_ticks + 1];
+        ReplayKeyframe* keyframes = new ReplayKeyframe[header.num_keyframes + 1];
+        uint8_t* keyframe_data = new uint8_t[header.keyframe_data_size + 1];
+        bool ok = fread(inputs, 1, header.num_ticks, file) == header.num_ticks &&
+                  fread(keyframes, sizeof(ReplayKeyframe), header.num_keyframes, file) == header.num_keyframes &&
+                  fread(keyframe_data, 1, header.keyframe_data_size, file) == header.keyframe_data_size;
+        fclose(file);
+
+        for(size_t k = 0; ok && k < header.num_keyframes; ++k)
+        {
+                const ReplayKeyframe& keyframe = keyframes[k];
+                ok = keyframe.tick <= header.num_ticks && (k == 0 || keyframe.tick > keyframes[k - 1].tick) &&
+                     keyframe.offset <= header.keyframe_data_size &&
+                     keyframe.size <= header.keyframe_data_size - keyframe.offset;
+        }
+
+        if(!ok)
+        {
+                delete[] inputs;
+                delete[] keyframes;
+                delete[] keyframe_data;
+                return false;
+        }
+
+        input_log_destroy(log);
+        log->width = header.width;
+        log->height = header.height;
+        log->particle_stress = header.particle_stress;
+        log->bullet_stress = header.bullet_stress;
+        log->num_ticks = header.num_ticks;
+        log->capacity = header.num_ticks + 1;
+        log->inputs = inputs;
+        log->keyframe_interval = header.keyframe_interval;
+        log->num_keyframes = header.num_keyframes;
+        log->keyframe_capacity = header.num_keyframes + 1;
+        log->keyframes = keyframes;
+        log->keyframe_data_size = header.keyframe_data_size;
+        log->keyframe_data_capacity = header.keyframe_data_size + 1;
+        log->keyframe_data = keyframe_data;
+        return true;
+}
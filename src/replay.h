@@ -0,0 +1,76 @@
+#ifndef SPACE_INVADERS_REPLAY_H
+#define SPACE_INVADERS_REPLAY_H
+
+// Input recording and replay. The simulation only depends on its config
+// and the input of every tick, so a session is recorded as the config
+// plus one byte of input per tick, and replaying the log reproduces the
+// session exactly. Every keyframe_interval ticks the full game state is
+// saved as well, so seeking only simulates the ticks since the keyframe
+// before the target. Window and GL free, shared by every front end.
+
+#include "game.h"
+
+// Replay file: a ReplayHeader, num_ticks input bytes, the index of
+// num_keyframes ReplayKeyframes and keyframe_data_size bytes of saved
+// states, in the byte order of the host that wrote it. Keyframe k is the
+// state before tick k * keyframe_interval.
+#define REPLAY_MAGIC 0x50524953u // "SIRP"
+#define REPLAY_VERSION 4
+#define REPLAY_DEFAULT_KEYFRAME_INTERVAL 600
+struct ReplayHeader
+{
+        uint32_t magic;
+        uint32_t version;
+        uint32_t width, height;
+        uint32_t particle_stress;
+        uint32_t bullet_stress;
+        uint32_t keyframe_interval;
+        uint32_t num_keyframes;
+        uint64_t num_ticks;
+        uint64_t keyframe_data_size;
+};
+
+struct ReplayKeyframe
+{
+        uint64_t tick;
+        // Saved state, a game_save_state blob in the keyframe data
+        uint64_t offset;
+        uint64_t size;
+};
+
+// Input of one tick
+#define INPUT_MOVE_LEFT  0x1
+#define INPUT_MOVE_RIGHT 0x2
+#define INPUT_FIRE       0x4
+
+struct InputLog
+{
+        // The config fields the simulation depends on
+        size_t width, height;
+        size_t particle_stress;
+        size_t bullet_stress;
+
+        size_t num_ticks;
+        size_t capacity;
+        uint8_t* inputs;
+
+        // No keyframes are recorded with an interval of 0
+        size_t keyframe_interval;
+        size_t num_keyframes;
+        size_t keyframe_capacity;
+        ReplayKeyframe* keyframes;
+        size_t keyframe_data_size;
+        size_t keyframe_data_capacity;
+        uint8_t* keyframe_data;
+};
+
+void input_log_init(InputLog* log, const GameConfig& config, size_t keyframe_interval);
+void input_log_destroy(InputLog* log);
+void input_log_record(InputLog* log, const Game* game, const GameInput& input);
+GameInput input_log_input(const InputLog* log, size_t tick);
+bool input_log_seek(const InputLog* log, Game* game, size_t tick, size_t* num_simulated);
+void input_log_apply_config(const InputLog* log, GameConfig* config);
+bool input_log_write(const InputLog* log, const char* path);
+bool input_log_read(InputLog* log, const char* path);
+
+#endif